@@ -10,6 +10,9 @@
 
 #include <bits/stdc++.h>
 #include "navigation_util.h"
+#include "landmarks.h"
+#include "navigation_map.h"
+#include "density_field.h"
 
 namespace bdm {
 
@@ -20,8 +23,40 @@ namespace bdm {
       double parent_i, parent_j;
       // f = g + h
       double f, g, h;
+      // true once the node is in the closed list
+      bool closed;
   };
 
+// ---------------------------------------------------------------------------
+  // per node values of a search, only for the nodes it reached: memory
+  // follows the searched region, not the map size. Unset nodes have
+  // default_value. References returned by At() stay valid when other
+  // nodes are inserted
+  template <typename T>
+  class SparseGrid {
+   public:
+    SparseGrid(int size, const T& default_value)
+        : size_(size), default_value_(default_value) {}
+
+    T& At(int row, int col) {
+      return values_.emplace(GetKey(row, col), default_value_).first->second;
+    }
+
+    const T& Get(int row, int col) const {
+      auto it = values_.find(GetKey(row, col));
+      return it == values_.end() ? default_value_ : it->second;
+    }
+
+   private:
+    int size_;
+    T default_value_;
+    std::unordered_map<uint64_t, T> values_;
+
+    uint64_t GetKey(int row, int col) const {
+      return static_cast<uint64_t>(row) * size_ + col;
+    }
+  }; // end SparseGrid
+
 // ---------------------------------------------------------------------------
   // check whether given node (row, col) is a valid node or not.
   inline bool IsValid(int row, int col, int sim_size) {
@@ -33,9 +68,9 @@ namespace bdm {
 
 // ---------------------------------------------------------------------------
   // check whether the given node is blocked or not
-  inline bool IsUnBlocked(std::vector<std::vector<bool>> grid, int row, int col) {
+  inline bool IsUnBlocked(const NavigationMap& grid, int row, int col) {
     // Returns true if the node is not blocked else false
-    if (grid[row][col] == 1) {
+    if (grid.IsWalkable(row, col)) {
       return true;
     }
     return false;
@@ -58,21 +93,44 @@ namespace bdm {
                           + (col-dest.second)*(col-dest.second)));
   }
 
+// ---------------------------------------------------------------------------
+  // calculate the 'h' heuristics, tightened by the landmarks lower bound
+  // if available. Both bounds are admissible, so is their maximum.
+  inline double CalculateHValue(int row, int col, std::pair<double, double> dest,
+                                const Landmarks* landmarks) {
+    double h = CalculateHValue(row, col, dest);
+    if (landmarks != nullptr && !landmarks->Empty()) {
+      h = std::max(h, landmarks->GetLowerBound(row, col, dest.first, dest.second));
+    }
+    return h;
+  }
+
+// ---------------------------------------------------------------------------
+  // extra cost of walking through a node, from the agents density,
+  // without the planning agent itself (at src)
+  inline double GetDensityCost(const DensityField* density, int row, int col,
+                               std::pair<double, double> src,
+                               std::pair<double, double> dest) {
+    if (density == nullptr || density->Empty()) {
+      return 0;
+    }
+    return density->GetCost(row, col, src, dest);
+  }
+
 // ---------------------------------------------------------------------------
   // trace the path from the destination to the source
-  inline std::vector<std::vector<double>> TracePath(std::vector<std::vector<node>> nodeDetails, std::pair<double, double> dest) {
+  inline std::vector<std::vector<double>> TracePath(const SparseGrid<node>& nodeDetails, std::pair<double, double> dest) {
 
     double row = dest.first;
     double col = dest.second;
     std::vector<std::vector<double>> Path;
 
-    while (!(nodeDetails[row][col].parent_i == row
-             && nodeDetails[row][col].parent_j == col )) {
+    const node* current = &nodeDetails.Get(row, col);
+    while (!(current->parent_i == row && current->parent_j == col)) {
       Path.push_back({row, col});
-      double temp_row = nodeDetails[row][col].parent_i;
-      double temp_col = nodeDetails[row][col].parent_j;
-      row = temp_row;
-      col = temp_col;
+      row = current->parent_i;
+      col = current->parent_j;
+      current = &nodeDetails.Get(row, col);
     }
     Path.push_back({row, col});
 
@@ -82,8 +140,12 @@ namespace bdm {
 // ---------------------------------------------------------------------------
   // find the shortest path between a given source node to a destination
   // node according to A* Search Algorithm
-  inline std::vector<std::vector<double>> AStar(std::vector<std::vector<bool>> grid,
-                           std::pair<double, double> src, std::pair<double, double> dest, const int sim_size) {
+  // landmarks (optional) are used to tighten the heuristic
+  // density (optional) adds a congestion cost to crowded nodes
+  inline std::vector<std::vector<double>> AStar(const NavigationMap& grid,
+                           std::pair<double, double> src, std::pair<double, double> dest, const int sim_size,
+                           const Landmarks* landmarks = nullptr,
+                           const DensityField* density = nullptr) {
 
     std::vector<std::vector<double>> path;
 
@@ -122,32 +184,28 @@ namespace bdm {
       return path;
     }
 
-    // Create a 2D vector of bool closed list and initialise it to false
-    // which means that no node has been included yet
-    std::vector<std::vector<bool>> closedList(sim_size, std::vector<bool>(sim_size, false));
-
-    // Declare a 2D vector to hold the details of that node
-    std::vector<std::vector<node>> nodeDetails(sim_size, std::vector<node>(sim_size));
+    // Declare a sparse grid to hold the details of the nodes, only
+    // allocated for the nodes reached by the search. The closed list is
+    // the closed flag of each node
+    node unvisited;
+    unvisited.f = FLT_MAX;
+    unvisited.g = FLT_MAX;
+    unvisited.h = FLT_MAX;
+    unvisited.parent_i = -1;
+    unvisited.parent_j = -1;
+    unvisited.closed = false;
+    SparseGrid<node> nodeDetails(sim_size, unvisited);
 
     int i, j;
 
-    for (i = 0; i < sim_size; i++) {
-      for (j = 0; j < sim_size; j++) {
-        nodeDetails[i][j].f = FLT_MAX;
-        nodeDetails[i][j].g = FLT_MAX;
-        nodeDetails[i][j].h = FLT_MAX;
-        nodeDetails[i][j].parent_i = -1;
-        nodeDetails[i][j].parent_j = -1;
-      }
-    }
-
     // Initialising the parameters of the starting node
     i = src.first, j = src.second;
-    nodeDetails[i][j].f = 0.0;
-    nodeDetails[i][j].g = 0.0;
-    nodeDetails[i][j].h = 0.0;
-    nodeDetails[i][j].parent_i = i;
-    nodeDetails[i][j].parent_j = j;
+    node& start = nodeDetails.At(i, j);
+    start.f = 0.0;
+    start.g = 0.0;
+    start.h = 0.0;
+    start.parent_i = i;
+    start.parent_j = j;
 
     // Create an open list having information as-
     // <f, <i, j>>
@@ -161,158 +219,71 @@ namespace bdm {
     // 'f' as 0
     openList.insert(std::make_pair (0.0, std::make_pair (i, j)));
 
+    // the 4 successors: North, South, East, West
+    const int moves[4][2] = {{-1, 0}, {1, 0}, {0, 1}, {0, -1}};
+
     while (!openList.empty()) {
       std::pair<double, std::pair<double, double>> p = *openList.begin();
 
       // Remove this vertex from the open list
       openList.erase(openList.begin());
 
-      // Add this vertex to the closed list
+      // Add this vertex to the closed list. Nodes are looked up once,
+      // the references stay valid while successors are inserted
       i = p.second.first;
       j = p.second.second;
-      closedList[i][j] = true;
+      node& current = nodeDetails.At(i, j);
+      current.closed = true;
 
       // To store the 'g', 'h' and 'f' of the 4 successors
       double gNew, hNew, fNew;
 
-      //----------- 1st Successor (North) ------------
-      // Only process this node if this is a valid one
-      if (IsValid(i-1, j, sim_size) == true) {
-        // If the destination node is the same as the
-        // current successor
-        if (IsDestination(i-1, j, dest) == true) {
-          // Set the Parent of the destination node
-          nodeDetails[i-1][j].parent_i = i;
-          nodeDetails[i-1][j].parent_j = j;
-          path = TracePath(nodeDetails, dest);
-          return path;
-        }
-        // If the successor is already on the closed
-        // list or if it is blocked, then ignore it.
-        // Else do the following
-        else if (closedList[i-1][j] == false &&
-                 IsUnBlocked(grid, i-1, j) == true) {
-          gNew = nodeDetails[i][j].g + 1.0;
-          hNew = CalculateHValue (i-1, j, dest);
-          fNew = gNew + hNew;
-
-          // If it isn’t on the open list, add it to
-          // the open list. Make the current square
-          // the parent of this square. Record the
-          // f, g, and h costs of the square node
-          //                OR
-          // If it is on the open list already, check
-          // to see if this path to that square is better,
-          // using 'f' cost as the measure.
-          if (nodeDetails[i-1][j].f == FLT_MAX ||
-              nodeDetails[i-1][j].f > fNew) {
-            openList.insert( std::make_pair(fNew, std::make_pair(i-1, j)));
-
-            // Update the details of this node
-            nodeDetails[i-1][j].f = fNew;
-            nodeDetails[i-1][j].g = gNew;
-            nodeDetails[i-1][j].h = hNew;
-            nodeDetails[i-1][j].parent_i = i;
-            nodeDetails[i-1][j].parent_j = j;
-          }
-        }
-      }
-
-      //----------- 2nd Successor (South) ------------
-      // Only process this node if this is a valid one
-      if (IsValid(i+1, j, sim_size) == true) {
-        // If the destination node is the same as the
-        // current successor
-        if (IsDestination(i+1, j, dest) == true) {
-          // Set the Parent of the destination node
-          nodeDetails[i+1][j].parent_i = i;
-          nodeDetails[i+1][j].parent_j = j;
-          path = TracePath(nodeDetails, dest);
-          return path;
-        }
-
-        else if (closedList[i+1][j] == false &&
-                 IsUnBlocked(grid, i+1, j) == true) {
-          gNew = nodeDetails[i][j].g + 1.0;
-          hNew = CalculateHValue(i+1, j, dest);
-          fNew = gNew + hNew;
-
-          if (nodeDetails[i+1][j].f == FLT_MAX ||
-              nodeDetails[i+1][j].f > fNew) {
-            openList.insert( std::make_pair (fNew, std::make_pair (i+1, j)));
-            // Update the details of this node
-            nodeDetails[i+1][j].f = fNew;
-            nodeDetails[i+1][j].g = gNew;
-            nodeDetails[i+1][j].h = hNew;
-            nodeDetails[i+1][j].parent_i = i;
-            nodeDetails[i+1][j].parent_j = j;
-          }
+      for (auto& move : moves) {
+        const int si = i + move[0], sj = j + move[1];
+        // Only process this node if this is a valid one
+        if (IsValid(si, sj, sim_size) == false) {
+          continue;
         }
-      }
-
-      //----------- 3rd Successor (East) ------------
-      // Only process this node if this is a valid one
-      if (IsValid (i, j+1, sim_size) == true) {
         // If the destination node is the same as the
         // current successor
-        if (IsDestination(i, j+1, dest) == true) {
+        if (IsDestination(si, sj, dest) == true) {
           // Set the Parent of the destination node
-          nodeDetails[i][j+1].parent_i = i;
-          nodeDetails[i][j+1].parent_j = j;
+          node& destination = nodeDetails.At(si, sj);
+          destination.parent_i = i;
+          destination.parent_j = j;
           path = TracePath(nodeDetails, dest);
           return path;
         }
-
-        else if (closedList[i][j+1] == false &&
-                 IsUnBlocked (grid, i, j+1) == true) {
-          gNew = nodeDetails[i][j].g + 1.0;
-          hNew = CalculateHValue (i, j+1, dest);
-          fNew = gNew + hNew;
-
-          if (nodeDetails[i][j+1].f == FLT_MAX ||
-              nodeDetails[i][j+1].f > fNew) {
-            openList.insert( std::make_pair(fNew, std::make_pair (i, j+1)));
-
-            // Update the details of this node
-            nodeDetails[i][j+1].f = fNew;
-            nodeDetails[i][j+1].g = gNew;
-            nodeDetails[i][j+1].h = hNew;
-            nodeDetails[i][j+1].parent_i = i;
-            nodeDetails[i][j+1].parent_j = j;
-          }
+        // If the successor is blocked or already on the closed
+        // list, then ignore it. Else do the following
+        if (IsUnBlocked(grid, si, sj) == false) {
+          continue;
         }
-      }
-
-      //----------- 4th Successor (West) ------------
-      // Only process this node if this is a valid one
-      if (IsValid(i, j-1, sim_size) == true) {
-        // If the destination node is the same as the
-        // current successor
-        if (IsDestination(i, j-1, dest) == true) {
-          // Set the Parent of the destination node
-          nodeDetails[i][j-1].parent_i = i;
-          nodeDetails[i][j-1].parent_j = j;
-          path = TracePath(nodeDetails, dest);
-          return path;
+        node& successor = nodeDetails.At(si, sj);
+        if (successor.closed) {
+          continue;
         }
-
-        else if (closedList[i][j-1] == false &&
-                 IsUnBlocked(grid, i, j-1) == true) {
-          gNew = nodeDetails[i][j].g + 1.0;
-          hNew = CalculateHValue(i, j-1, dest);
-          fNew = gNew + hNew;
-
-          if (nodeDetails[i][j-1].f == FLT_MAX ||
-              nodeDetails[i][j-1].f > fNew) {
-            openList.insert( std::make_pair (fNew, std::make_pair (i, j-1)));
-
-            // Update the details of this node
-            nodeDetails[i][j-1].f = fNew;
-            nodeDetails[i][j-1].g = gNew;
-            nodeDetails[i][j-1].h = hNew;
-            nodeDetails[i][j-1].parent_i = i;
-            nodeDetails[i][j-1].parent_j = j;
-          }
+        gNew = current.g + 1.0 + GetDensityCost(density, si, sj, src, dest);
+        hNew = CalculateHValue(si, sj, dest, landmarks);
+        fNew = gNew + hNew;
+
+        // If it isn’t on the open list, add it to
+        // the open list. Make the current square
+        // the parent of this square. Record the
+        // f, g, and h costs of the square node
+        //                OR
+        // If it is on the open list already, check
+        // to see if this path to that square is better,
+        // using 'f' cost as the measure.
+        if (successor.f == FLT_MAX || successor.f > fNew) {
+          openList.insert(std::make_pair(fNew, std::make_pair(si, sj)));
+
+          // Update the details of this node
+          successor.f = fNew;
+          successor.g = gNew;
+          successor.h = hNew;
+          successor.parent_i = i;
+          successor.parent_j = j;
         }
       }
 
@@ -0,0 +1,407 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef ANYTIME_PLANNER_H_
+#define ANYTIME_PLANNER_H_
+
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "a_star.h"
+#include "density_field.h"
+#include "landmarks.h"
+#include "navigation_map.h"
+
+namespace bdm {
+
+  // Path search that can be suspended after a number of node expansions or
+  // a time budget, and resumed later: Plan() is called once per step until
+  // the path is found, so a hard query never takes a whole timestep.
+  // Same moves, costs and heuristic as AStar().
+  // With epsilon > 1 this is ARA*: a first path, at most epsilon times
+  // longer than the shortest one, is found quickly, then epsilon is
+  // decreased by epsilon_step and the path improved, reusing the previous
+  // search, until epsilon is 1 (shortest path).
+  // Meanwhile the agent walks the search tree towards the best node found
+  // so far (GetNextNode()): the goal once a path is known, else the
+  // expanded node closest to the goal.
+  class AnytimePlanner {
+   public:
+    enum class Status {
+      // no path yet
+      kSearching,
+      // a path is known, it can still be improved
+      kImproving,
+      // shortest path found (or source is the destination)
+      kDone,
+      kNotFound
+    };
+
+    AnytimePlanner(const NavigationMap& grid, std::pair<double, double> src,
+                   std::pair<double, double> dest,
+                   const Landmarks* landmarks = nullptr,
+                   const DensityField* density = nullptr,
+                   double epsilon = 1, double epsilon_step = 0.5)
+        : grid_(grid), size_(grid.GetSize()), src_(src), dest_(dest),
+          landmarks_(landmarks), density_(density),
+          epsilon_(std::max(1.0, epsilon)), epsilon_step_(epsilon_step) {
+      if (!IsValid(src.first, src.second, size_) ||
+          !IsValid(dest.first, dest.second, size_) ||
+          !IsUnBlocked(grid, src.first, src.second) ||
+          !IsUnBlocked(grid, dest.first, dest.second)) {
+        status_ = Status::kNotFound;
+        return;
+      }
+      start_ = GetIndex(src.first, src.second);
+      goal_ = GetIndex(dest.first, dest.second);
+      agent_ = best_ = start_;
+      NodeState& start = GetNode(start_);
+      start.g = 0;
+      start.parent = start_;
+      best_h_ = start.h;
+      if (start_ == goal_) {
+        status_ = Status::kDone;
+        return;
+      }
+      open_.push({epsilon_ * start.h, 0, start_});
+    }
+
+    // expand at most max_expansions nodes, for at most max_time
+    // microseconds (0: no time limit). Dropping an outdated open entry
+    // counts as one expansion, and rebuilding the open list for a new
+    // epsilon as one per entry: a call can go over max_expansions by the
+    // size of one rebuild, never more
+    Status Plan(uint64_t max_expansions, double max_time = 0) {
+      const auto begin = std::chrono::steady_clock::now();
+      uint64_t expansions = 0;
+      // reading the clock costs more than an expansion
+      uint64_t next_clock_check = 64;
+      while (status_ == Status::kSearching || status_ == Status::kImproving) {
+        if (expansions >= max_expansions) {
+          break;
+        }
+        if (max_time > 0 && expansions >= next_clock_check) {
+          next_clock_check = expansions + 64;
+          if (std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - begin).count() > max_time) {
+            break;
+          }
+        }
+        if (!open_.empty() && IsOutdated(open_.top())) {
+          open_.pop();
+          expansions++;
+          continue;
+        }
+        // no node left can lead to a shorter path than the one known
+        double goal_g = GetG(goal_);
+        if (open_.empty() || goal_g <= open_.top().key) {
+          if (goal_g == Infinity()) {
+            status_ = Status::kNotFound;
+          } else if (epsilon_ <= 1) {
+            status_ = Status::kDone;
+          } else {
+            status_ = Status::kImproving;
+            expansions += DecreaseEpsilon();
+          }
+          continue;
+        }
+        Expand();
+        expansions++;
+      }
+      num_expansions_ += expansions;
+      return status_;
+    }
+
+    Status GetStatus() const { return status_; }
+
+    double GetEpsilon() const { return epsilon_; }
+
+    uint64_t GetNumExpansions() const { return num_expansions_; }
+
+    bool IsAtGoal() const { return status_ != Status::kNotFound && agent_ == goal_; }
+
+    // move the agent one node towards the best node found so far.
+    // Return false if it is already there
+    bool GetNextNode(std::pair<double, double>* node) {
+      if (status_ == Status::kNotFound) {
+        return false;
+      }
+      uint32_t target = GetG(goal_) < Infinity() ? goal_ : best_;
+      std::vector<uint32_t> path = GetTreePath(agent_, target);
+      if (path.empty()) {
+        return false;
+      }
+      agent_ = path[0];
+      *node = GetCoord(agent_);
+      return true;
+    }
+
+    // path from the agent node (excluded) to the destination, in the AStar()
+    // order: destination first. Empty if no path is known
+    std::vector<std::vector<double>> GetPath() const {
+      std::vector<std::vector<double>> path;
+      if (status_ == Status::kNotFound || GetG(goal_) == Infinity()) {
+        return path;
+      }
+      std::vector<uint32_t> nodes = GetTreePath(agent_, goal_);
+      for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+        auto coord = GetCoord(*it);
+        path.push_back({coord.first, coord.second});
+      }
+      return path;
+    }
+
+   private:
+    struct NodeState {
+      double g;
+      double h;
+      uint32_t parent;
+      // search iteration in which the node was closed / put in incons_
+      uint32_t closed = 0;
+      uint32_t incons = 0;
+    };
+
+    struct OpenEntry {
+      double key;
+      double g;
+      uint32_t node;
+
+      bool operator>(const OpenEntry& other) const { return key > other.key; }
+    };
+
+    const NavigationMap& grid_;
+    int size_;
+    std::pair<double, double> src_;
+    std::pair<double, double> dest_;
+    const Landmarks* landmarks_;
+    const DensityField* density_;
+    double epsilon_;
+    double epsilon_step_;
+    Status status_ = Status::kSearching;
+
+    uint32_t start_ = 0;
+    uint32_t goal_ = 0;
+    // node the agent stands on, always in the search tree
+    uint32_t agent_ = 0;
+    // expanded node closest to the goal
+    uint32_t best_ = 0;
+    double best_h_ = 0;
+    uint32_t iteration_ = 1;
+    uint64_t num_expansions_ = 0;
+
+    // only the nodes reached by the search, not the whole map
+    std::unordered_map<uint32_t, NodeState> nodes_;
+    // outdated entries are not removed, but skipped when popped
+    std::priority_queue<OpenEntry, std::vector<OpenEntry>,
+                        std::greater<OpenEntry>> open_;
+    // closed nodes whose g decreased during the current iteration
+    std::vector<uint32_t> incons_;
+
+    static double Infinity() { return std::numeric_limits<double>::infinity(); }
+
+    uint32_t GetIndex(int row, int col) const {
+      return static_cast<uint32_t>(row) * size_ + col;
+    }
+
+    std::pair<double, double> GetCoord(uint32_t node) const {
+      return std::make_pair(node / size_, node % size_);
+    }
+
+    double GetG(uint32_t node) const {
+      auto it = nodes_.find(node);
+      return it == nodes_.end() ? Infinity() : it->second.g;
+    }
+
+    NodeState& GetNode(uint32_t node) {
+      auto it = nodes_.find(node);
+      if (it == nodes_.end()) {
+        auto coord = GetCoord(node);
+        NodeState state;
+        state.g = Infinity();
+        state.h = CalculateHValue(coord.first, coord.second, dest_, landmarks_);
+        state.parent = node;
+        it = nodes_.emplace(node, state).first;
+      }
+      return it->second;
+    }
+
+    bool IsOutdated(const OpenEntry& entry) const {
+      const NodeState& state = nodes_.at(entry.node);
+      return state.closed == iteration_ || entry.g != state.g;
+    }
+
+    void Expand() {
+      OpenEntry entry = open_.top();
+      open_.pop();
+      // references to unordered_map elements stay valid on insertion
+      NodeState& state = nodes_.at(entry.node);
+      state.closed = iteration_;
+      if (state.h < best_h_) {
+        best_h_ = state.h;
+        best_ = entry.node;
+      }
+
+      int row = entry.node / size_, col = entry.node % size_;
+      const int moves[4][2] = {{-1, 0}, {1, 0}, {0, 1}, {0, -1}};
+      for (auto& move : moves) {
+        int i = row + move[0], j = col + move[1];
+        if (!IsValid(i, j, size_) || !IsUnBlocked(grid_, i, j)) {
+          continue;
+        }
+        double g = state.g + 1.0 + GetDensityCost(density_, i, j, src_, dest_);
+        uint32_t successor = GetIndex(i, j);
+        NodeState& next = GetNode(successor);
+        if (g >= next.g) {
+          continue;
+        }
+        next.g = g;
+        next.parent = entry.node;
+        if (next.closed != iteration_) {
+          open_.push({g + epsilon_ * next.h, g, successor});
+        } else if (next.incons != iteration_) {
+          // ARA*: expanded again in the next iteration only
+          next.incons = iteration_;
+          incons_.push_back(successor);
+        }
+      }
+    }
+
+    // start a new ARA* iteration: open and incons nodes are queued again
+    // with the new epsilon, nothing is closed. Return the number of entries
+    // moved
+    uint64_t DecreaseEpsilon() {
+      epsilon_ = epsilon_step_ > 0 ? std::max(1.0, epsilon_ - epsilon_step_) : 1;
+      const uint64_t moved = open_.size() + incons_.size();
+      std::vector<OpenEntry> entries;
+      while (!open_.empty()) {
+        if (!IsOutdated(open_.top())) {
+          entries.push_back(open_.top());
+        }
+        open_.pop();
+      }
+      for (auto node : incons_) {
+        const NodeState& state = nodes_.at(node);
+        entries.push_back({0, state.g, node});
+      }
+      incons_.clear();
+      iteration_++;
+      for (auto& entry : entries) {
+        entry.key = entry.g + epsilon_ * nodes_.at(entry.node).h;
+        open_.push(entry);
+      }
+      return moved;
+    }
+
+    // nodes from `from` (excluded) to `to`, through the search tree: up to
+    // their lowest common ancestor, then down
+    std::vector<uint32_t> GetTreePath(uint32_t from, uint32_t to) const {
+      std::vector<uint32_t> up = {from};
+      std::unordered_map<uint32_t, size_t> depth = {{from, 0}};
+      for (uint32_t node = from; nodes_.at(node).parent != node;) {
+        node = nodes_.at(node).parent;
+        depth[node] = up.size();
+        up.push_back(node);
+      }
+      std::vector<uint32_t> down;
+      uint32_t node = to;
+      while (depth.find(node) == depth.end()) {
+        down.push_back(node);
+        node = nodes_.at(node).parent;
+      }
+      std::vector<uint32_t> path(up.begin() + 1, up.begin() + depth[node] + 1);
+      path.insert(path.end(), down.rbegin(), down.rend());
+      return path;
+    }
+  }; // end AnytimePlanner
+
+// ---------------------------------------------------------------------------
+  // Searches in progress, one per agent uid, and the node expansions
+  // budget shared by all the agents for the current step. Thread safe
+  class AnytimePlannerPool {
+   public:
+    AnytimePlanner* Get(uint64_t uid) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = planners_.find(uid);
+      return it == planners_.end() ? nullptr : it->second.get();
+    }
+
+    AnytimePlanner* Add(uint64_t uid, std::unique_ptr<AnytimePlanner> planner) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& slot = planners_[uid];
+      slot = std::move(planner);
+      return slot.get();
+    }
+
+    void Remove(uint64_t uid) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      planners_.erase(uid);
+    }
+
+    size_t GetNumPlanners() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return planners_.size();
+    }
+
+    // take up to wanted expansions from the step_budget expansions of this
+    // step (0: no limit). An agent takes at most one slice of the budget
+    // per thread, so that the agents run concurrently all get a share.
+    // The expansions not used must be given back with ReleaseExpansions().
+    // Agents served once the budget is spent get 0 and keep walking
+    // towards their best node
+    uint64_t AcquireExpansions(uint64_t step, uint64_t wanted, uint64_t step_budget) {
+      if (step_budget == 0) {
+        return wanted;
+      }
+      if (budget_step_.load(std::memory_order_acquire) != step) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (budget_step_.load(std::memory_order_relaxed) != step) {
+          budget_left_.store(step_budget, std::memory_order_relaxed);
+          budget_step_.store(step, std::memory_order_release);
+        }
+      }
+      const uint64_t slice =
+        std::max<uint64_t>(1, step_budget / std::max(1, omp_get_max_threads()));
+      const int64_t request = std::min(wanted, slice);
+      int64_t left = budget_left_.load(std::memory_order_relaxed);
+      int64_t granted;
+      do {
+        granted = std::min(request, left);
+        if (granted <= 0) {
+          return 0;
+        }
+      } while (!budget_left_.compare_exchange_weak(left, left - granted));
+      return granted;
+    }
+
+    // give back the expansions acquired but not used during this step
+    void ReleaseExpansions(uint64_t step, uint64_t unused, uint64_t step_budget) {
+      if (step_budget == 0 || unused == 0 ||
+          budget_step_.load(std::memory_order_acquire) != step) {
+        return;
+      }
+      budget_left_.fetch_add(unused);
+    }
+
+   private:
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, std::unique_ptr<AnytimePlanner>> planners_;
+    std::atomic<uint64_t> budget_step_{std::numeric_limits<uint64_t>::max()};
+    std::atomic<int64_t> budget_left_{0};
+  }; // end AnytimePlannerPool
+
+} // namespace bdm
+
+#endif // ANYTIME_PLANNER_H_
@@ -14,19 +14,53 @@
 #include "sim-param.h"
 #include "a_star.h"
 #include "navigation_util.h"
+#include "navigation_map.h"
+#include "landmarks.h"
+#include "trajectory_writer.h"
+#include "density_field.h"
+#include "anytime_planner.h"
 
 namespace bdm {
 
 // ---------------------------------------------------------------------------
+// navigation data shared by all the humans. Owned by the simulation, it
+// must outlive the Navigation modules
+struct NavigationContext {
+  NavigationMap* navigation_map = nullptr;
+  Landmarks* landmarks = nullptr;
+  TrajectoryWriter* trajectory_writer = nullptr;
+  DensityField* density = nullptr;
+  // searches in progress, if paths are searched over several steps
+  AnytimePlannerPool* planners = nullptr;
+};
+
+// ---------------------------------------------------------------------------
+// process wide navigation context, set once by the simulation before the
+// first step and used by every Navigation module
+inline const NavigationContext*& GetNavigationContextHandle() {
+  static const NavigationContext* context = nullptr;
+  return context;
+}
+
+inline const NavigationContext* GetNavigationContext() {
+  return GetNavigationContextHandle();
+}
+
+inline void SetNavigationContext(const NavigationContext* context) {
+  GetNavigationContextHandle() = context;
+}
+
+// ---------------------------------------------------------------------------
+// Moves a human along a path to its next destination. The module has no
+// data at all: the progress along the path is stored in the Human
+// (navigation_phase_, path_cursor_) and the shared data is found with
+// GetNavigationContext(), so a module created by an event, copied or
+// streamed works as is
 struct Navigation : public BaseBiologyModule {
   BDM_STATELESS_BM_HEADER(Navigation, BaseBiologyModule, 1);
 
   Navigation() : BaseBiologyModule(gAllEventIds) {}
 
-  Navigation(std::vector<std::vector<bool>>* navigation_map) : BaseBiologyModule(gAllEventIds) {
-    navigation_map_ = navigation_map;
-  }
-
 
   void Run(SimObject* so) override {
     // auto* sim = Simulation::GetActive();
@@ -36,51 +70,184 @@ struct Navigation : public BaseBiologyModule {
 
     auto* human = bdm_static_cast<Human*>(so);
     const auto& position = human->GetPosition();
+    const auto* context = GetNavigationContext();
+    auto* trajectory_writer = context->trajectory_writer;
+
+    // a search may be in progress (restored checkpoint) without a budget
+    const bool has_to_plan =
+      (human->navigation_phase_ == kNavigationIdle ||
+       human->navigation_phase_ == kNavigationPlanning) &&
+      !human->destinations_list_.empty();
 
-    std::vector<std::vector<double>> path;
+    // if agent has to calculate path to destination, within a budget
+    if (has_to_plan && context->planners != nullptr) {
+      human->navigation_phase_ = kNavigationPlanning;
+      PlanStep(human);
+    }
 
     // if agent has to calculate path to destination
-    if (!path_calculated_ && !human->destinations_list_.empty()) {
+    else if (has_to_plan) {
       std::pair<double, double> start =
         std::make_pair(GetBDMToMapLoc(position[0]),
                        GetBDMToMapLoc(position[1]));
       std::pair<double, double> dest = human->destinations_list_[0];
 
       // calculate path using A*
-      path = AStar((*navigation_map_), start, dest, navigation_map_->size());
-
-      human->path_ = path;
+      human->path_ = FindPath(start, dest);
+      human->path_cursor_ = human->path_.size();
+      if (trajectory_writer) {
+        trajectory_writer->AddEvent(human->GetUid(),
+          human->path_.empty() ? PathEvent::kPathNotFound : PathEvent::kPathComputed,
+          human->path_.size());
+      }
       // remove this travel form destination_list
       human->destinations_list_.erase(human->destinations_list_.begin());
-      path_calculated_ = true;
+      human->navigation_phase_ = kNavigationFollowingPath;
     } // end if has to calculate path
 
     // if agent has its path, has to move to it
-    else if (path_calculated_) {
-
-      if (!human->path_.empty()) {
+    else if (human->navigation_phase_ == kNavigationFollowingPath) {
+
+      if (human->path_cursor_ > 0 && HasToReplan(human) &&
+          context->planners != nullptr) {
+        // search again over the next steps, to the same destination
+        human->destinations_list_.insert(human->destinations_list_.begin(),
+          std::make_pair(human->path_[0][0], human->path_[0][1]));
+        human->path_.clear();
+        human->path_cursor_ = 0;
+        human->navigation_phase_ = kNavigationPlanning;
+        PlanStep(human);
+      }
+      else if (human->path_cursor_ > 0) {
+        if (HasToReplan(human)) {
+          Replan(human);
+        }
+        const auto& node = human->path_[human->path_cursor_ - 1];
         Double3 next_position = {
-          GetMapToBDMLoc(human->path_[human->path_.size()-1][0]),
-          GetMapToBDMLoc(human->path_[human->path_.size()-1][1]),
-          position[2] };
+          GetMapToBDMLoc(node[0]), GetMapToBDMLoc(node[1]), position[2] };
         // navigate according to path
         human->SetPosition(next_position);
 
-        // if either on or after this path position
-        human->path_.erase(human->path_.end());
+        // this path position is reached
+        human->path_cursor_--;
       }
-      // path is empty, so destination is reached
+      // path is walked, so destination is reached
       else {
         // can add an other destination here
-        path_calculated_ = false;
+        human->navigation_phase_ = kNavigationIdle;
+        // no path was walked if none was found
+        if (trajectory_writer && !human->path_.empty()) {
+          trajectory_writer->AddEvent(human->GetUid(), PathEvent::kDestinationReached);
+        }
+        human->path_.clear();
       }
     } // end has its path
 
   } // end Run
 
 private:
-  bool path_calculated_ = false;
-  std::vector<std::vector<bool>>* navigation_map_;
+  std::vector<std::vector<double>> FindPath(std::pair<double, double> start,
+                                            std::pair<double, double> dest) const {
+    const auto* context = GetNavigationContext();
+    auto* navigation_map = context->navigation_map;
+    return AStar((*navigation_map), start, dest, navigation_map->GetSize(),
+                 context->landmarks, context->density);
+  }
+
+  // run the search of this human for one step, and walk towards the best
+  // node found so far. Once the search is over, the human follows the path
+  void PlanStep(Human* human) const {
+    auto* sim = Simulation::GetActive();
+    auto* sparam = sim->GetParam()->GetModuleParam<SimParam>();
+    const auto* context = GetNavigationContext();
+    auto* planners = context->planners;
+    auto* trajectory_writer = context->trajectory_writer;
+    const uint64_t uid = human->GetUid();
+
+    AnytimePlanner* planner = planners->Get(uid);
+    if (planner == nullptr) {
+      const auto& position = human->GetPosition();
+      std::pair<double, double> start =
+        std::make_pair(GetBDMToMapLoc(position[0]), GetBDMToMapLoc(position[1]));
+      planner = planners->Add(uid, std::unique_ptr<AnytimePlanner>(
+        new AnytimePlanner(*context->navigation_map, start,
+                           human->destinations_list_[0], context->landmarks,
+                           context->density, sparam->planner_epsilon,
+                           sparam->planner_epsilon_step)));
+    }
+
+    uint64_t wanted = sparam->planner_expansion_budget > 0 ?
+      sparam->planner_expansion_budget : std::numeric_limits<uint64_t>::max();
+    const uint64_t step = sim->GetScheduler()->GetSimulatedSteps();
+    uint64_t expansions = planners->AcquireExpansions(
+      step, wanted, sparam->planner_step_budget);
+    const uint64_t expanded = planner->GetNumExpansions();
+    auto status = planner->Plan(expansions, sparam->planner_time_budget);
+    // an open list rebuild can take more than what was acquired
+    const uint64_t used =
+      std::min(expansions, planner->GetNumExpansions() - expanded);
+    planners->ReleaseExpansions(step, expansions - used,
+                                sparam->planner_step_budget);
+
+    if (status == AnytimePlanner::Status::kDone ||
+        status == AnytimePlanner::Status::kNotFound || planner->IsAtGoal()) {
+      human->path_ = planner->GetPath();
+      human->path_cursor_ = human->path_.size();
+      if (trajectory_writer) {
+        trajectory_writer->AddEvent(uid,
+          status == AnytimePlanner::Status::kNotFound ?
+            PathEvent::kPathNotFound : PathEvent::kPathComputed,
+          human->path_.size());
+      }
+      // the human walked to the destination while the path was improved
+      if (trajectory_writer && planner->IsAtGoal() &&
+          planner->GetNumExpansions() > 0) {
+        trajectory_writer->AddEvent(uid, PathEvent::kDestinationReached);
+      }
+      human->destinations_list_.erase(human->destinations_list_.begin());
+      human->navigation_phase_ = kNavigationFollowingPath;
+      planners->Remove(uid);
+      return;
+    }
+
+    std::pair<double, double> node;
+    if (planner->GetNextNode(&node)) {
+      human->SetPosition({GetMapToBDMLoc(node.first), GetMapToBDMLoc(node.second),
+                          human->GetPosition()[2]});
+    }
+  }
+
+  // replan every density_replan_interval steps, to take the current crowd
+  // into account. Agents are staggered by uid not to all replan at once
+  bool HasToReplan(Human* human) const {
+    auto* sim = Simulation::GetActive();
+    auto* sparam = sim->GetParam()->GetModuleParam<SimParam>();
+    auto* density = GetNavigationContext()->density;
+    if (density == nullptr || density->Empty() ||
+        sparam->density_replan_interval == 0) {
+      return false;
+    }
+    uint64_t step = sim->GetScheduler()->GetSimulatedSteps();
+    return (step + human->GetUid()) % sparam->density_replan_interval == 0;
+  }
+
+  // plan again to the current destination (first node of the path)
+  void Replan(Human* human) const {
+    const auto& position = human->GetPosition();
+    std::pair<double, double> start =
+      std::make_pair(GetBDMToMapLoc(position[0]), GetBDMToMapLoc(position[1]));
+    std::pair<double, double> dest =
+      std::make_pair(human->path_[0][0], human->path_[0][1]);
+
+    std::vector<std::vector<double>> path = FindPath(start, dest);
+    // keep the previous path if no path is found
+    if (path.size() > 1) {
+      // the agent already is on the last node (start)
+      path.pop_back();
+      human->path_ = path;
+      human->path_cursor_ = path.size();
+    }
+  }
 }; // end Navigation
 
 }  // namespace bdm
@@ -0,0 +1,336 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef BOX_GEOM_H_
+#define BOX_GEOM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "TGeoBBox.h"
+#include "TGeoManager.h"
+#include "TGeoMatrix.h"
+#include "util_methods.h"
+
+namespace bdm {
+
+  // Native replacement of TGeo for geometries made of axis aligned boxes
+  // (MakeBox + translations, as in BuildMaze()).
+  // Boxes that are not made of "Air" are extracted from the TGeoManager and
+  // binned in a uniform grid over the x-y plane of the top volume. Each grid
+  // cell stores its boxes bounds as contiguous arrays, so that the slab tests
+  // of a query vectorise over the boxes of the cell.
+  // Queries follow TGeoNavigator semantics: DistToBoundary() is the distance
+  // to the next boundary crossed (box entry, box exit if inside a box, or
+  // top volume exit).
+  class BoxGeometry {
+   public:
+    explicit BoxGeometry(TGeoManager* geom, double cell_size = 10)
+        : cell_size_(cell_size) {
+      TGeoVolume* top = geom->GetTopVolume();
+      if (top->GetShape()->IsA() != TGeoBBox::Class()) {
+        supported_ = false;
+        return;
+      }
+      auto* world = static_cast<TGeoBBox*>(top->GetShape());
+      const double* origin = world->GetOrigin();
+      const double half[3] = {world->GetDX(), world->GetDY(), world->GetDZ()};
+      for (int i = 0; i < 3; i++) {
+        world_min_[i] = origin[i] - half[i];
+        world_max_[i] = origin[i] + half[i];
+      }
+
+      double offset[3] = {0, 0, 0};
+      ExtractBoxes(top, offset);
+
+      cells_x_ = std::max(1, static_cast<int>(std::ceil((world_max_[0] - world_min_[0]) / cell_size_)));
+      cells_y_ = std::max(1, static_cast<int>(std::ceil((world_max_[1] - world_min_[1]) / cell_size_)));
+      cells_.resize(cells_x_ * cells_y_);
+      for (auto& box : boxes_) {
+        int x0 = GetCellX(box.min[0]), x1 = GetCellX(box.max[0]);
+        int y0 = GetCellY(box.min[1]), y1 = GetCellY(box.max[1]);
+        for (int x = x0; x <= x1; x++) {
+          for (int y = y0; y <= y1; y++) {
+            cells_[x * cells_y_ + y].Add(box);
+          }
+        }
+      }
+    }
+
+    // false if the geometry contains anything else than translated boxes
+    bool IsSupported() const { return supported_; }
+
+    size_t GetNumBoxes() const { return boxes_.size(); }
+
+    bool IsInside(const Double3& position) const {
+      if (!IsInsideWorld(position)) {
+        return false;
+      }
+      const Cell& cell = GetCell(GetCellX(position[0]), GetCellY(position[1]));
+      const double px = position[0], py = position[1], pz = position[2];
+      const int n = cell.Size();
+      int inside = 0;
+      #pragma omp simd reduction(|:inside)
+      for (int b = 0; b < n; b++) {
+        inside |= (px >= cell.min_x[b]) & (px <= cell.max_x[b]) &
+                  (py >= cell.min_y[b]) & (py <= cell.max_y[b]) &
+                  (pz >= cell.min_z[b]) & (pz <= cell.max_z[b]);
+      }
+      return inside != 0;
+    }
+
+    // distance from origin, along the normalised direction, to the next
+    // boundary
+    double DistToBoundary(const Double3& origin, const Double3& direction) const {
+      Ray ray(origin, direction);
+
+      // inside a box: the next boundary is its exit
+      if (IsInside(origin)) {
+        const Cell& cell = GetCell(GetCellX(origin[0]), GetCellY(origin[1]));
+        double exit = std::numeric_limits<double>::max();
+        for (int b = 0; b < cell.Size(); b++) {
+          double t_near, t_far;
+          ray.Slab(cell, b, &t_near, &t_far);
+          if (t_near <= 0 && t_far >= 0) {
+            exit = std::min(exit, t_far);
+          }
+        }
+        return exit;
+      }
+
+      // otherwise, first box entry or top volume exit
+      double t_world = ray.Exit(world_min_, world_max_);
+      if (t_world <= 0) {
+        return 0;
+      }
+
+      // walk through the grid cells crossed by the ray (Amanatides & Woo)
+      int x = GetCellX(origin[0]);
+      int y = GetCellY(origin[1]);
+      const int step_x = direction[0] >= 0 ? 1 : -1;
+      const int step_y = direction[1] >= 0 ? 1 : -1;
+      double t_next_x = (world_min_[0] + (x + (step_x > 0)) * cell_size_ - origin[0]) * ray.inv[0];
+      double t_next_y = (world_min_[1] + (y + (step_y > 0)) * cell_size_ - origin[1]) * ray.inv[1];
+      const double t_delta_x = std::fabs(cell_size_ * ray.inv[0]);
+      const double t_delta_y = std::fabs(cell_size_ * ray.inv[1]);
+
+      double best = t_world;
+      while (true) {
+        best = std::min(best, ray.FirstEntry(GetCell(x, y)));
+        double t_cell_exit = std::min(t_next_x, t_next_y);
+        if (best <= t_cell_exit) {
+          return best;
+        }
+        if (t_next_x < t_next_y) {
+          x += step_x;
+          t_next_x += t_delta_x;
+        } else {
+          y += step_y;
+          t_next_y += t_delta_y;
+        }
+        if (x < 0 || x >= cells_x_ || y < 0 || y >= cells_y_) {
+          return best;
+        }
+      }
+    } // end DistToBoundary
+
+    // same as ObjectInbetween() in geom.h
+    bool ObjectInbetween(const Double3& position_a, const Double3& position_b) const {
+      Double3 d_ab = GetDifAB(position_a, position_b);
+      double dist_ab = GetDistance(d_ab);
+      return DistToBoundary(position_a, GetNormalisedDirection(dist_ab, d_ab)) < dist_ab;
+    }
+
+    // batch versions, rays are processed in parallel
+    void DistToBoundary(const std::vector<Double3>& origins,
+                        const std::vector<Double3>& directions,
+                        std::vector<double>* steps) const {
+      steps->resize(origins.size());
+      #pragma omp parallel for schedule(static)
+      for (size_t r = 0; r < origins.size(); r++) {
+        (*steps)[r] = DistToBoundary(origins[r], directions[r]);
+      }
+    }
+
+    void ObjectInbetween(const std::vector<Double3>& positions_a,
+                         const std::vector<Double3>& positions_b,
+                         std::vector<char>* hits) const {
+      hits->resize(positions_a.size());
+      #pragma omp parallel for schedule(static)
+      for (size_t r = 0; r < positions_a.size(); r++) {
+        (*hits)[r] = ObjectInbetween(positions_a[r], positions_b[r]);
+      }
+    }
+
+    void IsInside(const std::vector<Double3>& positions, std::vector<char>* inside) const {
+      inside->resize(positions.size());
+      #pragma omp parallel for schedule(static)
+      for (size_t p = 0; p < positions.size(); p++) {
+        (*inside)[p] = IsInside(positions[p]);
+      }
+    }
+
+   private:
+    struct Box {
+      double min[3];
+      double max[3];
+    };
+
+    // boxes overlapping a grid cell, structure of arrays
+    struct Cell {
+      std::vector<double> min_x, min_y, min_z, max_x, max_y, max_z;
+
+      int Size() const { return min_x.size(); }
+
+      void Add(const Box& box) {
+        min_x.push_back(box.min[0]);
+        min_y.push_back(box.min[1]);
+        min_z.push_back(box.min[2]);
+        max_x.push_back(box.max[0]);
+        max_y.push_back(box.max[1]);
+        max_z.push_back(box.max[2]);
+      }
+    };
+
+    struct Ray {
+      double origin[3];
+      double inv[3];
+
+      Ray(const Double3& o, const Double3& direction) {
+        for (int i = 0; i < 3; i++) {
+          origin[i] = o[i];
+          // avoid 0 * inf = NaN for rays parallel to a slab
+          inv[i] = 1.0 / (direction[i] != 0 ? direction[i] : 1e-300);
+        }
+      }
+
+      void Slab(const Cell& cell, int b, double* t_near, double* t_far) const {
+        double tx1 = (cell.min_x[b] - origin[0]) * inv[0];
+        double tx2 = (cell.max_x[b] - origin[0]) * inv[0];
+        double ty1 = (cell.min_y[b] - origin[1]) * inv[1];
+        double ty2 = (cell.max_y[b] - origin[1]) * inv[1];
+        double tz1 = (cell.min_z[b] - origin[2]) * inv[2];
+        double tz2 = (cell.max_z[b] - origin[2]) * inv[2];
+        *t_near = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+        *t_far = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+      }
+
+      // entry distance of the closest box of the cell hit by the ray
+      double FirstEntry(const Cell& cell) const {
+        const double ox = origin[0], oy = origin[1], oz = origin[2];
+        const double ix = inv[0], iy = inv[1], iz = inv[2];
+        const int n = cell.Size();
+        double best = std::numeric_limits<double>::max();
+        #pragma omp simd reduction(min:best)
+        for (int b = 0; b < n; b++) {
+          double tx1 = (cell.min_x[b] - ox) * ix;
+          double tx2 = (cell.max_x[b] - ox) * ix;
+          double ty1 = (cell.min_y[b] - oy) * iy;
+          double ty2 = (cell.max_y[b] - oy) * iy;
+          double tz1 = (cell.min_z[b] - oz) * iz;
+          double tz2 = (cell.max_z[b] - oz) * iz;
+          double t_near = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)),
+                                   std::min(tz1, tz2));
+          double t_far = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)),
+                                  std::max(tz1, tz2));
+          double t = (t_near <= t_far && t_far >= 0)
+                         ? std::max(t_near, 0.0)
+                         : std::numeric_limits<double>::max();
+          best = std::min(best, t);
+        }
+        return best;
+      }
+
+      // exit distance of a box containing the origin
+      double Exit(const double* min, const double* max) const {
+        double t_far = std::numeric_limits<double>::max();
+        for (int i = 0; i < 3; i++) {
+          t_far = std::min(t_far, std::max((min[i] - origin[i]) * inv[i],
+                                           (max[i] - origin[i]) * inv[i]));
+        }
+        return t_far;
+      }
+    }; // end Ray
+
+    double cell_size_;
+    bool supported_ = true;
+    double world_min_[3];
+    double world_max_[3];
+    int cells_x_ = 1;
+    int cells_y_ = 1;
+    std::vector<Box> boxes_;
+    std::vector<Cell> cells_;
+
+    void ExtractBoxes(TGeoVolume* volume, const double* offset) {
+      for (int i = 0; i < volume->GetNdaughters(); i++) {
+        TGeoNode* node = volume->GetNode(i);
+        TGeoMatrix* matrix = node->GetMatrix();
+        TGeoShape* shape = node->GetVolume()->GetShape();
+        if (matrix->IsRotation() || shape->IsA() != TGeoBBox::Class()) {
+          supported_ = false;
+          continue;
+        }
+        auto* bbox = static_cast<TGeoBBox*>(shape);
+        const double* translation = matrix->GetTranslation();
+        const double* origin = bbox->GetOrigin();
+        const double half[3] = {bbox->GetDX(), bbox->GetDY(), bbox->GetDZ()};
+        double centre[3];
+        for (int d = 0; d < 3; d++) {
+          centre[d] = offset[d] + translation[d] + origin[d];
+        }
+
+        if (std::strcmp(node->GetMedium()->GetName(), "Air") == 0) {
+          // walkable volume, its daughters can still be obstacles
+          ExtractBoxes(node->GetVolume(), centre);
+          continue;
+        }
+        // holes inside an obstacle are not handled
+        if (node->GetVolume()->GetNdaughters() > 0) {
+          supported_ = false;
+        }
+        Box box;
+        for (int d = 0; d < 3; d++) {
+          box.min[d] = centre[d] - half[d];
+          box.max[d] = centre[d] + half[d];
+        }
+        boxes_.push_back(box);
+      }
+    } // end ExtractBoxes
+
+    int GetCellX(double x) const {
+      return std::min(cells_x_ - 1, std::max(0, static_cast<int>((x - world_min_[0]) / cell_size_)));
+    }
+
+    int GetCellY(double y) const {
+      return std::min(cells_y_ - 1, std::max(0, static_cast<int>((y - world_min_[1]) / cell_size_)));
+    }
+
+    const Cell& GetCell(int x, int y) const { return cells_[x * cells_y_ + y]; }
+
+    bool IsInsideWorld(const Double3& position) const {
+      for (int i = 0; i < 3; i++) {
+        if (position[i] < world_min_[i] || position[i] > world_max_[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }; // end BoxGeometry
+
+// ---------------------------------------------------------------------------
+  // native geometry used by the geom.h queries, if any
+  inline std::unique_ptr<BoxGeometry>& GetNativeGeometry() {
+    static std::unique_ptr<BoxGeometry> native_geometry;
+    return native_geometry;
+  } // end GetNativeGeometry
+
+}  // namespace bdm
+
+#endif // BOX_GEOM_H_
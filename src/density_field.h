@@ -0,0 +1,110 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef DENSITY_FIELD_H_
+#define DENSITY_FIELD_H_
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace bdm {
+
+  // Number of agents per bin of the navigation map, rebuilt every step.
+  // A bin covers bin_size * bin_size map nodes (about an agent footprint).
+  // GetCost() is the extra cost for the planner to walk through a node,
+  // so that agents spread over alternative routes instead of all going
+  // through the same doorway.
+  class DensityField {
+   public:
+    DensityField() {}
+
+    DensityField(int map_size, int bin_size, double weight)
+        : bin_size_(std::max(1, bin_size)), weight_(weight) {
+      bins_per_side_ = (map_size + bin_size_ - 1) / bin_size_;
+      counts_.assign(bins_per_side_ * bins_per_side_, 0);
+    }
+
+    // rebuild the field from the agents positions, in map coordinates.
+    // Parallel histogram: each thread fills its own copy of the bins,
+    // then the copies are summed bin by bin
+    void Update(const std::vector<std::pair<double, double>>& positions) {
+      const int num_bins = counts_.size();
+      const int num_positions = positions.size();
+      const int num_threads = omp_get_max_threads();
+      thread_counts_.assign(static_cast<size_t>(num_threads) * num_bins, 0);
+
+      #pragma omp parallel num_threads(num_threads)
+      {
+        uint32_t* local = &thread_counts_[static_cast<size_t>(omp_get_thread_num()) * num_bins];
+        #pragma omp for schedule(static)
+        for (int p = 0; p < num_positions; p++) {
+          int bx = GetBinCoord(positions[p].first);
+          int by = GetBinCoord(positions[p].second);
+          local[bx * bins_per_side_ + by]++;
+        }
+      }
+
+      #pragma omp parallel for schedule(static)
+      for (int b = 0; b < num_bins; b++) {
+        uint32_t count = 0;
+        for (int t = 0; t < num_threads; t++) {
+          count += thread_counts_[static_cast<size_t>(t) * num_bins + b];
+        }
+        counts_[b] = count;
+      }
+    }
+
+    bool Empty() const { return counts_.empty(); }
+
+    // number of agents in the bin of node (x, y)
+    uint32_t GetDensity(int x, int y) const {
+      return counts_[(x / bin_size_) * bins_per_side_ + y / bin_size_];
+    }
+
+    // extra cost to walk through node (x, y)
+    double GetCost(int x, int y) const {
+      return weight_ * GetDensity(x, y);
+    }
+
+    // extra cost to walk through node (x, y), for an agent planning from
+    // src to dest: the agent does not count itself, and the destination
+    // bin is free as every path has to enter it
+    double GetCost(int x, int y, std::pair<double, double> src,
+                   std::pair<double, double> dest) const {
+      if (IsSameBin(x, y, dest.first, dest.second)) {
+        return 0;
+      }
+      uint32_t count = GetDensity(x, y);
+      if (count > 0 && IsSameBin(x, y, src.first, src.second)) {
+        count--;
+      }
+      return weight_ * count;
+    }
+
+   private:
+    int bin_size_ = 1;
+    int bins_per_side_ = 0;
+    double weight_ = 0;
+    std::vector<uint32_t> counts_;
+    std::vector<uint32_t> thread_counts_;
+
+    int GetBinCoord(double x) const {
+      return std::min(bins_per_side_ - 1, std::max(0, static_cast<int>(x) / bin_size_));
+    }
+
+    bool IsSameBin(int x, int y, double other_x, double other_y) const {
+      return GetBinCoord(x) == GetBinCoord(other_x) &&
+             GetBinCoord(y) == GetBinCoord(other_y);
+    }
+  }; // end DensityField
+
+} // namespace bdm
+
+#endif // DENSITY_FIELD_H_
@@ -0,0 +1,285 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef DESTINATION_MANAGER_H_
+#define DESTINATION_MANAGER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bdm {
+
+  // Keep track of the destinations (seats, exits, ...) of the simulation and
+  // allocate them to agents, one agent per destination.
+  // Free destinations are stored in a uniform grid over the navigation map,
+  // so that the nearest free destination is found by looking at the
+  // neighbouring buckets only. Positions are in navigation map coordinates.
+  // All public methods are thread safe.
+  class DestinationManager {
+   public:
+    enum class Mode { kGreedy, kAuction };
+
+    enum { kNone = -1 };
+
+    DestinationManager(double map_size, double bucket_size)
+        : bucket_size_(bucket_size) {
+      grid_size_ = std::max(1, static_cast<int>(std::ceil(map_size / bucket_size)));
+      buckets_.resize(grid_size_ * grid_size_);
+    }
+
+    static Mode GetMode(const std::string& name) {
+      if (name == "auction") {
+        return Mode::kAuction;
+      }
+      return Mode::kGreedy;
+    }
+
+    // add a new free destination, return its id
+    int AddDestination(std::pair<double, double> destination) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      int id = destinations_.size();
+      destinations_.push_back(destination);
+      taken_.push_back(false);
+      slot_.push_back(-1);
+      Insert(id);
+      return id;
+    }
+
+    // set a previously assigned destination free again
+    void ReleaseDestination(int id) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (id < 0 || id >= static_cast<int>(destinations_.size()) || !taken_[id]) {
+        return;
+      }
+      taken_[id] = false;
+      Insert(id);
+    }
+
+    std::pair<double, double> GetDestination(int id) const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return destinations_[id];
+    }
+
+    // all destinations and whether they are assigned, for checkpoints
+    void GetState(std::vector<std::pair<double, double>>* destinations,
+                  std::vector<bool>* taken) const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      *destinations = destinations_;
+      *taken = taken_;
+    }
+
+    void SetState(const std::vector<std::pair<double, double>>& destinations,
+                  const std::vector<bool>& taken) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto& bucket : buckets_) {
+        bucket.clear();
+      }
+      free_count_ = 0;
+      destinations_ = destinations;
+      taken_ = taken;
+      slot_.assign(destinations_.size(), -1);
+      for (size_t id = 0; id < destinations_.size(); id++) {
+        if (!taken_[id]) {
+          Insert(id);
+        }
+      }
+    }
+
+    size_t GetNumFreeDestinations() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return free_count_;
+    }
+
+    // assign a free destination to each agent of the batch, all at once.
+    // return the destination id of each agent, or kNone if none is left.
+    // kGreedy gives each agent, in order, its nearest free destination.
+    // kAuction minimises the total travelled distance of the batch.
+    std::vector<int> Assign(const std::vector<std::pair<double, double>>& positions,
+                            Mode mode = Mode::kGreedy) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<int> assignment(positions.size(), kNone);
+      if (mode == Mode::kAuction) {
+        Auction(positions, &assignment);
+      }
+      // greedy pass, also used for the agents the auction left unassigned
+      for (size_t a = 0; a < positions.size() && free_count_ > 0; a++) {
+        if (assignment[a] == kNone) {
+          std::vector<int> nearest = GetNearest(positions[a], 1);
+          assignment[a] = nearest[0];
+          Remove(nearest[0]);
+        }
+      }
+      return assignment;
+    }
+
+   private:
+    // number of candidate destinations each agent bids on during an auction
+    static constexpr int kAuctionCandidates = 8;
+
+    double bucket_size_;
+    int grid_size_;
+    // free destinations ids, per bucket
+    std::vector<std::vector<int>> buckets_;
+    std::vector<std::pair<double, double>> destinations_;
+    std::vector<bool> taken_;
+    // position of each free destination in its bucket
+    std::vector<int> slot_;
+    size_t free_count_ = 0;
+    mutable std::mutex mutex_;
+
+    int GetBucketCoord(double x) const {
+      return std::min(grid_size_ - 1, std::max(0, static_cast<int>(x / bucket_size_)));
+    }
+
+    static double GetSquaredDistance(std::pair<double, double> a,
+                                     std::pair<double, double> b) {
+      return (a.first - b.first) * (a.first - b.first) +
+             (a.second - b.second) * (a.second - b.second);
+    }
+
+    void Insert(int id) {
+      auto& bucket = buckets_[GetBucketCoord(destinations_[id].first) * grid_size_ +
+                              GetBucketCoord(destinations_[id].second)];
+      slot_[id] = bucket.size();
+      bucket.push_back(id);
+      free_count_++;
+    }
+
+    void Remove(int id) {
+      auto& bucket = buckets_[GetBucketCoord(destinations_[id].first) * grid_size_ +
+                              GetBucketCoord(destinations_[id].second)];
+      // swap with the last element of the bucket
+      int last = bucket.back();
+      bucket[slot_[id]] = last;
+      slot_[last] = slot_[id];
+      bucket.pop_back();
+      slot_[id] = -1;
+      taken_[id] = true;
+      free_count_--;
+    }
+
+    // k nearest free destinations from position, closest first.
+    // Search the buckets ring by ring around the position, until the next
+    // ring cannot contain anything closer than the k-th best found.
+    std::vector<int> GetNearest(std::pair<double, double> position, size_t k) const {
+      std::vector<std::pair<double, int>> found;
+      const int bx = GetBucketCoord(position.first);
+      const int by = GetBucketCoord(position.second);
+      for (int ring = 0; ring < grid_size_; ring++) {
+        if (found.size() >= k) {
+          // closest a destination of this ring can be
+          double ring_dist = (ring - 1) * bucket_size_;
+          if (ring_dist > 0 && ring_dist * ring_dist > found[k - 1].first) {
+            break;
+          }
+        }
+        for (int x = bx - ring; x <= bx + ring; x++) {
+          if (x < 0 || x >= grid_size_) {
+            continue;
+          }
+          // only the border of the ring
+          int step = (x == bx - ring || x == bx + ring) ? 1 : 2 * ring;
+          for (int y = by - ring; y <= by + ring; y += std::max(1, step)) {
+            if (y < 0 || y >= grid_size_) {
+              continue;
+            }
+            for (int id : buckets_[x * grid_size_ + y]) {
+              found.emplace_back(GetSquaredDistance(position, destinations_[id]), id);
+            }
+          }
+        }
+        std::sort(found.begin(), found.end());
+        if (found.size() > k) {
+          found.resize(k);
+        }
+      }
+
+      std::vector<int> nearest;
+      for (auto& f : found) {
+        nearest.push_back(f.second);
+      }
+      return nearest;
+    } // end GetNearest
+
+    // Bertsekas auction over the k nearest free destinations of each agent.
+    // Agents outbid each other on prices; the value of a destination is
+    // minus its distance. Agents that cannot win any candidate are left
+    // to the greedy pass.
+    void Auction(const std::vector<std::pair<double, double>>& positions,
+                 std::vector<int>* assignment) {
+      const int n = positions.size();
+      if (n == 0 || free_count_ == 0) {
+        return;
+      }
+
+      // candidates are read only here, look them up in parallel
+      std::vector<std::vector<int>> candidates(n);
+      #pragma omp parallel for schedule(static)
+      for (int a = 0; a < n; a++) {
+        candidates[a] = GetNearest(positions[a], kAuctionCandidates);
+      }
+
+      std::vector<double> price(destinations_.size(), 0);
+      std::vector<int> owner(destinations_.size(), kNone);
+      const double epsilon = bucket_size_ / (n + 1);
+      // bound the number of bids, in case there is not enough candidates
+      const long max_bids = 10L * n * kAuctionCandidates;
+
+      std::vector<int> unassigned;
+      for (int a = n - 1; a >= 0; a--) {
+        unassigned.push_back(a);
+      }
+      for (long bid = 0; bid < max_bids && !unassigned.empty(); bid++) {
+        int a = unassigned.back();
+        unassigned.pop_back();
+
+        int best = kNone;
+        double best_value = -std::numeric_limits<double>::max();
+        double second_value = -std::numeric_limits<double>::max();
+        for (int id : candidates[a]) {
+          double value = -std::sqrt(GetSquaredDistance(positions[a], destinations_[id])) -
+                         price[id];
+          if (value > best_value) {
+            second_value = best_value;
+            best_value = value;
+            best = id;
+          } else if (value > second_value) {
+            second_value = value;
+          }
+        }
+        if (best == kNone) {
+          continue;
+        }
+        // single candidate: outbid by a map length
+        if (second_value == -std::numeric_limits<double>::max()) {
+          second_value = best_value - bucket_size_ * grid_size_;
+        }
+        price[best] += best_value - second_value + epsilon;
+        if (owner[best] != kNone) {
+          (*assignment)[owner[best]] = kNone;
+          unassigned.push_back(owner[best]);
+        }
+        owner[best] = a;
+        (*assignment)[a] = best;
+      }
+
+      for (int a = 0; a < n; a++) {
+        if ((*assignment)[a] != kNone) {
+          Remove((*assignment)[a]);
+        }
+      }
+    } // end Auction
+  }; // end DestinationManager
+
+} // namespace bdm
+
+#endif // DESTINATION_MANAGER_H_
@@ -0,0 +1,278 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef DISTANCE_FIELD_H_
+#define DISTANCE_FIELD_H_
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "navigation_map.h"
+
+namespace bdm {
+
+  // Shortest walking distance from every node of the navigation map to the
+  // nearest of a set of source nodes (exits, destinations...), in map nodes.
+  // Computed by repeated sweeps over the whole grid until nothing changes:
+  //  - vertical passes, top to bottom then bottom to top: a row only depends
+  //    on the one or two rows before it, so all its nodes are updated at
+  //    once (omp simd, columns split between threads)
+  //  - horizontal pass: each row is scanned left to right then right to
+  //    left, rows in parallel
+  // The grid is padded with two blocked nodes on each side so that the
+  // kernels have no bound checks. Moves never cut the corner of a blocked
+  // node.
+  class DistanceField {
+   public:
+    enum class Metric {
+      // up, down, left, right: same moves as AStar()
+      k4Connected,
+      // plus diagonals, of length sqrt(2)
+      k8Connected,
+      // plus knight moves, 5x5 chamfer (5, 7, 11) / 5: at most 2% off the
+      // euclidean distance in open space
+      kEuclideanApprox
+    };
+
+    DistanceField() {}
+
+    DistanceField(const NavigationMap& navigation_map,
+                  const std::vector<std::pair<int, int>>& sources,
+                  Metric metric = Metric::k8Connected) {
+      Compute(navigation_map, sources, metric);
+    }
+
+    // compute the distances from sources, given in map nodes. Unwalkable
+    // sources are ignored. Return the number of sweep iterations
+    int Compute(const NavigationMap& navigation_map,
+                const std::vector<std::pair<int, int>>& sources,
+                Metric metric = Metric::k8Connected) {
+      size_ = navigation_map.GetSize();
+      stride_ = size_ + 2 * kPadding;
+      metric_ = metric;
+      SetWeights(metric);
+
+      free_.assign(static_cast<size_t>(stride_) * stride_, 0);
+      distances_.assign(static_cast<size_t>(stride_) * stride_, Infinity());
+      #pragma omp parallel for schedule(dynamic)
+      for (int x = 0; x < size_; x++) {
+        uint8_t* free_row = &free_[GetIndex(x, 0)];
+        for (int y = 0; y < size_; y++) {
+          free_row[y] = navigation_map.IsWalkable(x, y);
+        }
+      }
+      for (auto& source : sources) {
+        if (IsInside(source.first, source.second) &&
+            free_[GetIndex(source.first, source.second)]) {
+          distances_[GetIndex(source.first, source.second)] = 0;
+        }
+      }
+
+      int iterations = 0;
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        changed |= VerticalPass(1);
+        changed |= VerticalPass(-1);
+        changed |= HorizontalPass();
+        iterations++;
+      }
+      return iterations;
+    }
+
+    bool Empty() const { return distances_.empty(); }
+
+    int GetSize() const { return size_; }
+
+    Metric GetMetric() const { return metric_; }
+
+    static float Infinity() { return std::numeric_limits<float>::infinity(); }
+
+    // distance from node (x, y) to the nearest source, Infinity() if it
+    // is blocked or cannot reach any source
+    float GetDistance(int x, int y) const {
+      return distances_[GetIndex(x, y)];
+    }
+
+    bool IsReachable(int x, int y) const {
+      return GetDistance(x, y) < Infinity();
+    }
+
+    // next move from node (x, y) along a shortest path to the nearest
+    // source, as an offset (dx, dy). Return false at a source, or if no
+    // source can be reached
+    bool GetFlowDirection(int x, int y, int* dx, int* dy) const {
+      const float distance = GetDistance(x, y);
+      if (distance == 0 || distance == Infinity()) {
+        return false;
+      }
+      const int radius = metric_ == Metric::kEuclideanApprox ? 2 : 1;
+      float best = Infinity();
+      for (int i = -radius; i <= radius; i++) {
+        for (int j = -radius; j <= radius; j++) {
+          float weight = GetMoveWeight(x, y, i, j);
+          if (weight == Infinity()) {
+            continue;
+          }
+          float candidate = distances_[GetIndex(x + i, y + j)] + weight;
+          if (candidate < best) {
+            best = candidate;
+            *dx = i;
+            *dy = j;
+          }
+        }
+      }
+      return best < Infinity();
+    }
+
+    // raw distances, row major with a padding of GetPadding() nodes on
+    // each side of each row: node (x, y) is at
+    // (x + GetPadding()) * GetStride() + y + GetPadding()
+    const std::vector<float>& GetDistances() const { return distances_; }
+
+    int GetStride() const { return stride_; }
+
+    static int GetPadding() { return kPadding; }
+
+   private:
+    enum { kPadding = 2 };
+
+    int size_ = 0;
+    int stride_ = 0;
+    Metric metric_ = Metric::k8Connected;
+    float orthogonal_ = 1;
+    float diagonal_ = 0;
+    float knight_ = 0;
+    // 1 if the node is walkable, 0 if blocked or padding
+    std::vector<uint8_t> free_;
+    std::vector<float> distances_;
+
+    size_t GetIndex(int x, int y) const {
+      return static_cast<size_t>(x + kPadding) * stride_ + y + kPadding;
+    }
+
+    bool IsInside(int x, int y) const {
+      return x >= 0 && y >= 0 && x < size_ && y < size_;
+    }
+
+    void SetWeights(Metric metric) {
+      orthogonal_ = 1;
+      diagonal_ = Infinity();
+      knight_ = Infinity();
+      if (metric == Metric::k8Connected) {
+        diagonal_ = std::sqrt(2.0f);
+      } else if (metric == Metric::kEuclideanApprox) {
+        diagonal_ = 7.0f / 5;
+        knight_ = 11.0f / 5;
+      }
+    }
+
+    // length of the move from (x, y) to (x + i, y + j), Infinity() if not
+    // allowed. Same rules as the sweep kernels
+    float GetMoveWeight(int x, int y, int i, int j) const {
+      if ((i == 0 && j == 0) || !IsInside(x + i, y + j) ||
+          !free_[GetIndex(x + i, y + j)]) {
+        return Infinity();
+      }
+      const int di = std::abs(i), dj = std::abs(j);
+      if (di + dj == 1) {
+        return orthogonal_;
+      }
+      if (di == 1 && dj == 1) {
+        bool open = free_[GetIndex(x + i, y)] && free_[GetIndex(x, y + j)];
+        return open ? diagonal_ : Infinity();
+      }
+      if (di + dj == 3) {
+        // the two nodes the knight move passes between
+        int si = i / 2, sj = j / 2;
+        int ti = i - si, tj = j - sj;
+        bool open = free_[GetIndex(x + si, y + sj)] &&
+                    free_[GetIndex(x + ti, y + tj)];
+        return open ? knight_ : Infinity();
+      }
+      return Infinity();
+    }
+
+    // update every row from the one or two rows before it, in the sweep
+    // direction (1: increasing x, -1: decreasing x)
+    bool VerticalPass(int direction) {
+      const int first = direction > 0 ? 1 : size_ - 2;
+      const int size = size_;
+      const float orthogonal = orthogonal_, diagonal = diagonal_,
+                  knight = knight_, infinity = Infinity();
+      const bool use_knight = knight_ < Infinity();
+      int changed = 0;
+
+      #pragma omp parallel
+      for (int x = first; x >= 0 && x < size; x += direction) {
+        float* row = &distances_[GetIndex(x, 0)];
+        const float* prev = &distances_[GetIndex(x - direction, 0)];
+        const float* prev2 = &distances_[GetIndex(x - 2 * direction, 0)];
+        const uint8_t* f0 = &free_[GetIndex(x, 0)];
+        const uint8_t* f1 = &free_[GetIndex(x - direction, 0)];
+
+        #pragma omp for simd schedule(static) reduction(|:changed)
+        for (int y = 0; y < size; y++) {
+          float d = row[y];
+          d = std::min(d, prev[y] + orthogonal);
+          // diagonals, through the two shared neighbours
+          float left = (f1[y] & f0[y - 1]) ? prev[y - 1] + diagonal : infinity;
+          float right = (f1[y] & f0[y + 1]) ? prev[y + 1] + diagonal : infinity;
+          d = std::min(d, std::min(left, right));
+          if (use_knight) {
+            // from two rows before, one column aside
+            float k1 = (f1[y] & f1[y - 1]) ? prev2[y - 1] + knight : infinity;
+            float k2 = (f1[y] & f1[y + 1]) ? prev2[y + 1] + knight : infinity;
+            // from the row before, two columns aside
+            float k3 = (f0[y - 1] & f1[y - 1]) ? prev[y - 2] + knight : infinity;
+            float k4 = (f0[y + 1] & f1[y + 1]) ? prev[y + 2] + knight : infinity;
+            d = std::min(d, std::min(std::min(k1, k2), std::min(k3, k4)));
+          }
+          d = f0[y] ? d : infinity;
+          changed |= d < row[y];
+          row[y] = d;
+        }
+      }
+      return changed != 0;
+    }
+
+    // scan every row in both directions, rows in parallel
+    bool HorizontalPass() {
+      const int size = size_;
+      const float orthogonal = orthogonal_;
+      int changed = 0;
+
+      #pragma omp parallel for schedule(static) reduction(|:changed)
+      for (int x = 0; x < size; x++) {
+        float* row = &distances_[GetIndex(x, 0)];
+        const uint8_t* f0 = &free_[GetIndex(x, 0)];
+        for (int y = 1; y < size; y++) {
+          float d = row[y - 1] + orthogonal;
+          if (f0[y] && d < row[y]) {
+            row[y] = d;
+            changed = 1;
+          }
+        }
+        for (int y = size - 2; y >= 0; y--) {
+          float d = row[y + 1] + orthogonal;
+          if (f0[y] && d < row[y]) {
+            row[y] = d;
+            changed = 1;
+          }
+        }
+      }
+      return changed != 0;
+    }
+  }; // end DistanceField
+
+} // namespace bdm
+
+#endif // DISTANCE_FIELD_H_
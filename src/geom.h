@@ -8,12 +8,45 @@
 #ifndef GEOM_H_
 #define GEOM_H_
 
+#include <cstring>
+#include <random>
 #include "TGeometry.h"
 #include "TGeoManager.h"
 #include "util_methods.h"
+#include "box_geom.h"
 
 namespace bdm {
 
+  // navigator of the calling thread. Cached per thread, so that the hot path
+  // never goes through the TGeoManager navigators lookup (and its lock).
+  // The cache is tied to gGeoManager: when the geometry is rebuilt, each
+  // thread fetches a navigator of the new manager on its next call.
+  // Threads not warmed up by InitNavigatorPool() get their own navigator
+  // on first use.
+  inline TGeoNavigator* GetNavigator() {
+    static thread_local TGeoManager* manager = nullptr;
+    static thread_local TGeoNavigator* navigator = nullptr;
+    if (manager != gGeoManager) {
+      manager = gGeoManager;
+      navigator = gGeoManager->GetCurrentNavigator();
+      if (!navigator) navigator = gGeoManager->AddNavigator();
+    }
+    return navigator;
+  } // end GetNavigator
+
+// ---------------------------------------------------------------------------
+  // create the navigator of each OpenMP thread, from within that thread as
+  // TGeo binds navigators to the thread that created them
+  inline void InitNavigatorPool() {
+    int max_threads = ThreadInfo::GetInstance()->GetMaxThreads();
+    #pragma omp parallel num_threads(max_threads)
+    {
+      GetNavigator();
+    }
+    std::cout << "geom navigators created (" << max_threads << ")" << std::endl;
+  } // end InitNavigatorPool
+
+// ---------------------------------------------------------------------------
   inline TGeoManager* BuildMaze() {
 
     TGeoManager *geom = new TGeoManager("maze", "geometry test for agent navigation");
@@ -55,11 +88,10 @@ namespace bdm {
 
     std::cout << "geom construction done" << std::endl;
 
-    // set max threads
-    // compilation error when using ThreadInfo:
-    // /usr/bin/ld: CMakeFiles/epidemio_2-room.dir/src/epidemio_2-room.cc.o: undefined reference to symbol 'numa_num_configured_nodes@@libnuma_1.2'
-    // gGeoManager->SetMaxThreads(ThreadInfo::GetInstance()->GetMaxThreads());
-    gGeoManager->SetMaxThreads(4);
+    // one navigator per thread used by BioDynaMo
+    // (ThreadInfo requires linking against libnuma, see CMakeLists.txt)
+    gGeoManager->SetMaxThreads(ThreadInfo::GetInstance()->GetMaxThreads());
+    InitNavigatorPool();
 
     // export geom to gdml file
     geom->Export("navigation.gdml");
@@ -70,8 +102,7 @@ namespace bdm {
 
 // ---------------------------------------------------------------------------
   inline TGeoNode* GetNextNode(Double3 positionA, Double3 positionB) {
-    TGeoNavigator *nav = gGeoManager->GetCurrentNavigator();
-    if (!nav) nav = gGeoManager->AddNavigator();
+    TGeoNavigator *nav = GetNavigator();
 
     Double3 diffAB = GetDifAB(positionA, positionB);
     double distAB = GetDistance(diffAB);
@@ -93,10 +124,9 @@ namespace bdm {
   } // end GetNextNode
 
 // ---------------------------------------------------------------------------
-  // return node distance from A, in direction A->B
-  inline double DistToNode(Double3 positionA, Double3 dABNorm) {
-    TGeoNavigator *nav = gGeoManager->GetCurrentNavigator();
-    if (!nav) nav = gGeoManager->AddNavigator();
+  // return node distance from A, in direction A->B, computed by TGeo
+  inline double TGeoDistToNode(Double3 positionA, Double3 dABNorm) {
+    TGeoNavigator *nav = GetNavigator();
 
     // Double3 to double [3] conversion
     double a[3]; double dAB[3];
@@ -114,6 +144,15 @@ namespace bdm {
     double step = nav->GetStep();
 
     return step;
+  } // end TGeoDistToNode
+
+// ---------------------------------------------------------------------------
+  // return node distance from A, in direction A->B
+  inline double DistToNode(Double3 positionA, Double3 dABNorm) {
+    if (auto* native = GetNativeGeometry().get()) {
+      return native->DistToBoundary(positionA, dABNorm);
+    }
+    return TGeoDistToNode(positionA, dABNorm);
   } // end DistToNode
 
 // ---------------------------------------------------------------------------
@@ -142,22 +181,75 @@ namespace bdm {
   } // end IsObjInbetween
 
 // ---------------------------------------------------------------------------
-  inline bool IsInsideStructure(Double3 position) {
-    TGeoNavigator *nav = gGeoManager->GetCurrentNavigator();
-    if (!nav) nav = gGeoManager->AddNavigator();
+  inline bool TGeoIsInsideStructure(Double3 position) {
+    TGeoNavigator *nav = GetNavigator();
 
     TGeoNode* node = nav->FindNode(position[0], position[1], position[2]);
-    std::string medium_name = node->GetMedium()->GetName();
     // std::cout << "Point "
     //           << position[0] << " " << position[1] << " " << position[2]
     //           << " is inside " << node->GetName()
     //           << " (" << node->GetMedium()->GetName() << ")" << std::endl;
-    if (medium_name != "Air") {
+    if (std::strcmp(node->GetMedium()->GetName(), "Air") != 0) {
       return true;
     }
     return false;
+  } // end TGeoIsInsideStruct
+
+// ---------------------------------------------------------------------------
+  inline bool IsInsideStructure(Double3 position) {
+    if (auto* native = GetNativeGeometry().get()) {
+      return native->IsInside(position);
+    }
+    return TGeoIsInsideStructure(position);
   } // end IsInsideStruct
 
+// ---------------------------------------------------------------------------
+  // extract the boxes of gGeoManager to answer the geometry queries natively.
+  // The native answers are checked against TGeo on random points and rays;
+  // TGeo is kept if the geometry is not supported or if they do not match
+  inline bool UseNativeGeometry(double cell_size, int samples = 10000,
+                                double tolerance = 1e-6) {
+    std::unique_ptr<BoxGeometry> native(new BoxGeometry(gGeoManager, cell_size));
+    if (!native->IsSupported()) {
+      std::cout << "native geometry not supported, using TGeo" << std::endl;
+      return false;
+    }
+
+    auto* box = static_cast<TGeoBBox*>(gGeoManager->GetTopVolume()->GetShape());
+    const double* origin = box->GetOrigin();
+    const double half[3] = {box->GetDX(), box->GetDY(), box->GetDZ()};
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    int mismatches = 0;
+    for (int s = 0; s < samples; s++) {
+      Double3 position, direction;
+      for (int i = 0; i < 3; i++) {
+        position[i] = origin[i] + half[i] * uniform(generator);
+        direction[i] = uniform(generator);
+      }
+      direction = GetNormalisedDirection(GetDistance(direction), direction);
+      bool inside = TGeoIsInsideStructure(position);
+      if (native->IsInside(position) != inside) {
+        mismatches++;
+      }
+      // the exit distance is ill defined inside overlapping nodes
+      else if (!inside && std::fabs(native->DistToBoundary(position, direction) -
+                                    TGeoDistToNode(position, direction)) > tolerance) {
+        mismatches++;
+      }
+    }
+    if (mismatches > 0) {
+      std::cout << "native geometry differs from TGeo (" << mismatches << "/"
+                << samples << "), using TGeo" << std::endl;
+      return false;
+    }
+
+    std::cout << "native geometry used (" << native->GetNumBoxes() << " boxes)"
+              << std::endl;
+    GetNativeGeometry() = std::move(native);
+    return true;
+  } // end UseNativeGeometry
+
 }  // namespace bdm
 
 #endif // GEOM_H_
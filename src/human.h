@@ -14,8 +14,19 @@
 
 namespace bdm {
 
+// navigation progress of a human, see Navigation
+enum NavigationPhase : uint8_t {
+  // no path: plan to the next destination, if any
+  kNavigationIdle = 0,
+  // walking along path_
+  kNavigationFollowingPath = 1,
+  // path search to destinations_list_[0] in progress, over several steps
+  kNavigationPlanning = 2
+};
+
 class Human : public Cell {
-  BDM_SIM_OBJECT_HEADER(Human, Cell, 1, state_, destinations_list_, path_);
+  BDM_SIM_OBJECT_HEADER(Human, Cell, 2, state_, destinations_list_, path_,
+                        path_cursor_, navigation_phase_);
 
  public:
   Human() {}
@@ -27,8 +38,12 @@ class Human : public Cell {
   int state_ = 0;
   // store the destinations
   std::vector<std::pair<double, double>> destinations_list_;
-  // store the path to a destination
+  // store the path to a destination, from the destination to the start
   std::vector<std::vector<double>> path_;
+  // number of path_ nodes left to walk: the next one is path_[path_cursor_-1]
+  uint32_t path_cursor_ = 0;
+  // a NavigationPhase
+  uint8_t navigation_phase_ = kNavigationIdle;
 };
 
 }  // namespace bdm
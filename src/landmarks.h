@@ -0,0 +1,182 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef LANDMARKS_H_
+#define LANDMARKS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "navigation_map.h"
+
+namespace bdm {
+
+  // ALT (A*, Landmarks, Triangle inequality) preprocessing of a navigation
+  // map. For each landmark L we store the grid distance d(L, n) to every
+  // node n. As d is a metric, |d(L, n) - d(L, dest)| <= d(n, dest) gives
+  // an admissible lower bound that follows the walls of the map.
+  struct Landmarks {
+    // distances are saturated to kMaxDistance; kUnreachable marks nodes
+    // that are blocked or not connected to the landmark
+    static constexpr uint16_t kUnreachable = std::numeric_limits<uint16_t>::max();
+    static constexpr uint16_t kMaxDistance = kUnreachable - 1;
+
+    int map_size = 0;
+    // landmark position (row, col) on the navigation map
+    std::vector<std::pair<int, int>> cells;
+    // one distance table per landmark, stored row major (row * map_size + col)
+    std::vector<std::vector<uint16_t>> distances;
+
+    bool Empty() const { return cells.empty(); }
+
+    // tightest triangle inequality bound over all landmarks
+    double GetLowerBound(int row, int col, int dest_row, int dest_col) const {
+      const size_t node = static_cast<size_t>(row) * map_size + col;
+      const size_t dest = static_cast<size_t>(dest_row) * map_size + dest_col;
+      int bound = 0;
+      for (const auto& table : distances) {
+        uint16_t d_node = table[node];
+        uint16_t d_dest = table[dest];
+        // saturated distances do not give a valid bound
+        if (d_node >= kMaxDistance || d_dest >= kMaxDistance) {
+          continue;
+        }
+        bound = std::max(bound, std::abs(d_node - d_dest));
+      }
+      return bound;
+    }
+  }; // end Landmarks
+
+// ---------------------------------------------------------------------------
+  // pick k landmarks spread along the map border: k target points are evenly
+  // spaced on the border and the walkable node closest to each one is kept.
+  // Landmarks "behind" the map give the tightest bounds.
+  // Nodes are searched in growing squares around the target, so that only
+  // the map tiles around the border are rasterized.
+  inline std::vector<std::pair<int, int>> SelectLandmarks(
+      const NavigationMap& grid, int k) {
+    std::vector<std::pair<int, int>> cells;
+    const int map_size = grid.GetSize();
+    if (k <= 0 || map_size < 2) {
+      return cells;
+    }
+
+    const double perimeter = 4.0 * (map_size - 1);
+    for (int l = 0; l < k; l++) {
+      // walk along the border, clockwise from (0, 0)
+      double s = std::fmod(l * perimeter / k, perimeter);
+      int side = static_cast<int>(s / (map_size - 1));
+      double offset = s - side * (map_size - 1);
+      double target_row, target_col;
+      switch (side) {
+        case 0: target_row = 0; target_col = offset; break;
+        case 1: target_row = offset; target_col = map_size - 1; break;
+        case 2: target_row = map_size - 1; target_col = map_size - 1 - offset; break;
+        default: target_row = map_size - 1 - offset; target_col = 0; break;
+      }
+
+      double best_dist = std::numeric_limits<double>::max();
+      std::pair<int, int> best_cell(-1, -1);
+      const int centre_row = static_cast<int>(target_row);
+      const int centre_col = static_cast<int>(target_col);
+      for (int ring = 0; ring < map_size && best_cell.first < 0; ring++) {
+        for (int row = centre_row - ring; row <= centre_row + ring; row++) {
+          for (int col = centre_col - ring; col <= centre_col + ring; col++) {
+            // only the border of the square
+            if (std::abs(row - centre_row) != ring &&
+                std::abs(col - centre_col) != ring) {
+              continue;
+            }
+            if (row < 0 || row >= map_size || col < 0 || col >= map_size ||
+                !grid.IsWalkable(row, col)) {
+              continue;
+            }
+            double dist = (row - target_row) * (row - target_row) +
+                          (col - target_col) * (col - target_col);
+            if (dist < best_dist) {
+              best_dist = dist;
+              best_cell = std::make_pair(row, col);
+            }
+          }
+        }
+      }
+      // no walkable node, or landmark already picked
+      if (best_cell.first < 0 ||
+          std::find(cells.begin(), cells.end(), best_cell) != cells.end()) {
+        continue;
+      }
+      cells.push_back(best_cell);
+    }
+    return cells;
+  } // end SelectLandmarks
+
+// ---------------------------------------------------------------------------
+  // breadth first search from a landmark, using the same 4-neighbourhood
+  // and unit cost as AStar()
+  inline std::vector<uint16_t> ComputeLandmarkDistances(
+      const NavigationMap& grid, std::pair<int, int> landmark) {
+    const int map_size = grid.GetSize();
+    std::vector<uint16_t> table(static_cast<size_t>(map_size) * map_size,
+                                uint16_t{Landmarks::kUnreachable});
+
+    std::vector<int> queue;
+    queue.reserve(table.size());
+    table[landmark.first * map_size + landmark.second] = 0;
+    queue.push_back(landmark.first * map_size + landmark.second);
+
+    const int d_row[4] = {-1, 1, 0, 0};
+    const int d_col[4] = {0, 0, 1, -1};
+    for (size_t head = 0; head < queue.size(); head++) {
+      int row = queue[head] / map_size;
+      int col = queue[head] % map_size;
+      uint16_t dist = table[queue[head]];
+      uint16_t next_dist =
+          dist < Landmarks::kMaxDistance ? dist + 1 : Landmarks::kMaxDistance;
+      for (int n = 0; n < 4; n++) {
+        int r = row + d_row[n];
+        int c = col + d_col[n];
+        if (r < 0 || r >= map_size || c < 0 || c >= map_size || !grid.IsWalkable(r, c)) {
+          continue;
+        }
+        int index = r * map_size + c;
+        if (table[index] == Landmarks::kUnreachable) {
+          table[index] = next_dist;
+          queue.push_back(index);
+        }
+      }
+    }
+    return table;
+  } // end ComputeLandmarkDistances
+
+// ---------------------------------------------------------------------------
+  // build the landmark distance tables of a navigation map
+  // one breadth first search per landmark, run in parallel
+  inline Landmarks GetLandmarks(const NavigationMap& grid,
+                                int landmark_count) {
+    Landmarks landmarks;
+    landmarks.map_size = grid.GetSize();
+    landmarks.cells = SelectLandmarks(grid, landmark_count);
+    landmarks.distances.resize(landmarks.cells.size());
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t l = 0; l < landmarks.cells.size(); l++) {
+      landmarks.distances[l] = ComputeLandmarkDistances(grid, landmarks.cells[l]);
+    }
+
+    std::cout << "landmarks created (" << landmarks.cells.size() << ")"
+              << std::endl;
+    return landmarks;
+  } // end GetLandmarks
+
+} // namespace bdm
+
+#endif // LANDMARKS_H_
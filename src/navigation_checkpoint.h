@@ -0,0 +1,341 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef NAVIGATION_CHECKPOINT_H_
+#define NAVIGATION_CHECKPOINT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "a_star.h"
+#include "behavior.h"
+#include "destination_manager.h"
+#include "human.h"
+#include "landmarks.h"
+#include "navigation_map.h"
+#include "sim-param.h"
+
+namespace bdm {
+
+  // Snapshot of the navigation state, so that a restarted run does not
+  // have to rasterize the map, build the landmarks or plan the paths again.
+  // Binary layout: header | map tiles | landmarks | destinations | humans.
+  // Arrays are written as a uint64_t size followed by the raw elements.
+  namespace checkpoint {
+    static const char kMagic[8] = {'N', 'A', 'V', 'C', 'K', 'P', 'T', '\0'};
+    static const uint32_t kVersion = 2;
+
+    struct Header {
+      char magic[8];
+      uint32_t version;
+      int32_t map_size;
+      int32_t map_pixel_size;
+      double human_diameter;
+      uint64_t simulated_steps;
+    };
+
+    template <typename T>
+    void Write(std::FILE* file, const T& value) {
+      std::fwrite(&value, sizeof(T), 1, file);
+    }
+
+    template <typename T>
+    void WriteVector(std::FILE* file, const std::vector<T>& values) {
+      Write(file, static_cast<uint64_t>(values.size()));
+      std::fwrite(values.data(), sizeof(T), values.size(), file);
+    }
+
+    template <typename T>
+    bool Read(std::FILE* file, T* value) {
+      return std::fread(value, sizeof(T), 1, file) == 1;
+    }
+
+    // size of the file, in bytes. Array sizes are checked against it
+    // before anything is allocated
+    inline uint64_t GetFileSize(std::FILE* file) {
+      long position = std::ftell(file);
+      std::fseek(file, 0, SEEK_END);
+      long size = std::ftell(file);
+      std::fseek(file, position, SEEK_SET);
+      return size < 0 ? 0 : size;
+    }
+
+    template <typename T>
+    bool ReadVector(std::FILE* file, uint64_t file_size,
+                    std::vector<T>* values) {
+      uint64_t size;
+      if (!Read(file, &size)) {
+        return false;
+      }
+      // a corrupted size can not allocate more than the file holds
+      long position = std::ftell(file);
+      if (position < 0 || static_cast<uint64_t>(position) > file_size ||
+          size > (file_size - position) / sizeof(T)) {
+        return false;
+      }
+      values->resize(size);
+      return std::fread(values->data(), sizeof(T), size, file) == size;
+    }
+
+    // path nodes and destinations are (x, y) pairs
+    inline std::vector<double> Flatten(const std::vector<std::vector<double>>& path) {
+      std::vector<double> flat;
+      for (auto& node : path) {
+        flat.push_back(node[0]);
+        flat.push_back(node[1]);
+      }
+      return flat;
+    }
+
+    inline std::vector<double> Flatten(const std::vector<std::pair<double, double>>& list) {
+      std::vector<double> flat;
+      for (auto& node : list) {
+        flat.push_back(node.first);
+        flat.push_back(node.second);
+      }
+      return flat;
+    }
+  } // namespace checkpoint
+
+// ---------------------------------------------------------------------------
+  // write the navigation state to file. The snapshot is written to a
+  // temporary file first, then renamed: an interrupted save never
+  // corrupts the previous checkpoint
+  inline bool SaveCheckpoint(const std::string& file_name,
+                             const NavigationMap& navigation_map,
+                             const Landmarks& landmarks,
+                             const DestinationManager& destinations,
+                             ResourceManager* rm, uint64_t simulated_steps) {
+    auto* sparam = Simulation::GetActive()->GetParam()->GetModuleParam<SimParam>();
+    using namespace checkpoint;
+
+    std::string tmp_name = file_name + ".tmp";
+    std::FILE* file = std::fopen(tmp_name.c_str(), "wb");
+    if (!file) {
+      std::cout << "could not write checkpoint " << tmp_name << std::endl;
+      return false;
+    }
+
+    Header header;
+    std::memcpy(header.magic, kMagic, sizeof(header.magic));
+    header.version = kVersion;
+    header.map_size = navigation_map.GetSize();
+    header.map_pixel_size = sparam->map_pixel_size;
+    header.human_diameter = sparam->human_diameter;
+    header.simulated_steps = simulated_steps;
+    Write(file, header);
+
+    // rasterized tiles only
+    std::vector<uint64_t> tile_ids;
+    for (size_t t = 0; t < navigation_map.GetNumTiles(); t++) {
+      if (navigation_map.IsTileRasterized(t)) {
+        tile_ids.push_back(t);
+      }
+    }
+    WriteVector(file, tile_ids);
+    for (auto t : tile_ids) {
+      std::fwrite(navigation_map.GetTileRows(t), sizeof(uint64_t),
+                  NavigationMap::kTileSize, file);
+    }
+
+    Write(file, static_cast<int32_t>(landmarks.map_size));
+    WriteVector(file, landmarks.cells);
+    for (auto& table : landmarks.distances) {
+      WriteVector(file, table);
+    }
+
+    std::vector<std::pair<double, double>> destination_list;
+    std::vector<bool> taken;
+    destinations.GetState(&destination_list, &taken);
+    WriteVector(file, destination_list);
+    WriteVector(file, std::vector<uint8_t>(taken.begin(), taken.end()));
+
+    std::vector<Human*> humans;
+    rm->ApplyOnAllElements([&](SimObject* so) {
+      if (auto* human = dynamic_cast<Human*>(so)) {
+        humans.push_back(human);
+      }
+    });
+    Write(file, static_cast<uint64_t>(humans.size()));
+    for (auto* human : humans) {
+      bool has_navigation = false;
+      for (auto* bm : human->GetAllBiologyModules()) {
+        has_navigation |= dynamic_cast<Navigation*>(bm) != nullptr;
+      }
+      const auto& position = human->GetPosition();
+      Write(file, position[0]);
+      Write(file, position[1]);
+      Write(file, position[2]);
+      Write(file, human->GetDiameter());
+      Write(file, static_cast<int32_t>(human->state_));
+      Write(file, static_cast<uint8_t>(has_navigation));
+      Write(file, human->navigation_phase_);
+      Write(file, human->path_cursor_);
+      WriteVector(file, Flatten(human->path_));
+      WriteVector(file, Flatten(human->destinations_list_));
+    }
+
+    bool ok = !std::ferror(file);
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+      std::cout << "could not write checkpoint " << file_name << std::endl;
+      return false;
+    }
+    std::cout << "checkpoint saved (" << humans.size() << " humans, "
+              << tile_ids.size() << " map tiles)" << std::endl;
+    return true;
+  } // end SaveCheckpoint
+
+// ---------------------------------------------------------------------------
+  // restore the navigation state saved by SaveCheckpoint. The map must have
+  // been created with the same parameters. Humans are created with their
+  // path, destinations and a Navigation module; they still have to be
+  // added to the resource manager. Uids are not restored: restored humans
+  // get new uids, so their trajectory events do not continue the ones of
+  // the previous run
+  inline bool LoadCheckpoint(const std::string& file_name,
+                             NavigationMap* navigation_map,
+                             Landmarks* landmarks,
+                             DestinationManager* destinations,
+                             std::vector<Human*>* humans,
+                             uint64_t* simulated_steps) {
+    auto* sparam = Simulation::GetActive()->GetParam()->GetModuleParam<SimParam>();
+    using namespace checkpoint;
+
+    std::FILE* file = std::fopen(file_name.c_str(), "rb");
+    if (!file) {
+      std::cout << "could not open checkpoint " << file_name << std::endl;
+      return false;
+    }
+
+    Header header;
+    if (!Read(file, &header) || std::memcmp(header.magic, kMagic, 8) != 0 ||
+        header.version != kVersion) {
+      std::cout << "invalid checkpoint " << file_name << std::endl;
+      std::fclose(file);
+      return false;
+    }
+    if (header.map_size != navigation_map->GetSize() ||
+        header.map_pixel_size != sparam->map_pixel_size ||
+        header.human_diameter != sparam->human_diameter) {
+      std::cout << "checkpoint " << file_name
+                << " was made with a different navigation map" << std::endl;
+      std::fclose(file);
+      return false;
+    }
+    const uint64_t file_size = GetFileSize(file);
+
+    // everything is read first, and only applied if the whole file is
+    // valid: a truncated checkpoint leaves the state untouched
+    bool ok = true;
+    std::vector<uint64_t> tile_ids;
+    ok = ok && ReadVector(file, file_size, &tile_ids);
+    std::vector<uint64_t> tile_rows;
+    for (size_t i = 0; ok && i < tile_ids.size(); i++) {
+      ok = tile_ids[i] < navigation_map->GetNumTiles();
+      tile_rows.resize((i + 1) * NavigationMap::kTileSize);
+      ok = ok && std::fread(&tile_rows[i * NavigationMap::kTileSize],
+                            sizeof(uint64_t), NavigationMap::kTileSize,
+                            file) == NavigationMap::kTileSize;
+    }
+
+    Landmarks new_landmarks;
+    int32_t landmarks_map_size = 0;
+    ok = ok && Read(file, &landmarks_map_size);
+    new_landmarks.map_size = landmarks_map_size;
+    ok = ok && ReadVector(file, file_size, &new_landmarks.cells);
+    // landmarks must be on the map, with one distance per map node
+    const int map_size = navigation_map->GetSize();
+    const size_t num_nodes = static_cast<size_t>(map_size) * map_size;
+    if (ok && !new_landmarks.Empty()) {
+      ok = new_landmarks.map_size == map_size;
+      for (auto& cell : new_landmarks.cells) {
+        ok = ok && IsValid(cell.first, cell.second, map_size);
+      }
+    }
+    new_landmarks.distances.resize(ok ? new_landmarks.cells.size() : 0);
+    for (auto& table : new_landmarks.distances) {
+      ok = ok && ReadVector(file, file_size, &table) &&
+           table.size() == num_nodes;
+    }
+
+    std::vector<std::pair<double, double>> destination_list;
+    std::vector<uint8_t> taken;
+    ok = ok && ReadVector(file, file_size, &destination_list) &&
+         ReadVector(file, file_size, &taken) &&
+         taken.size() == destination_list.size();
+
+    std::vector<Human*> new_humans;
+    uint64_t num_humans = 0;
+    ok = ok && Read(file, &num_humans);
+    for (uint64_t h = 0; ok && h < num_humans; h++) {
+      Double3 position;
+      double diameter;
+      int32_t state;
+      uint8_t has_navigation, navigation_phase;
+      uint32_t path_cursor;
+      std::vector<double> path, destinations_list;
+      ok = Read(file, &position[0]) && Read(file, &position[1]) &&
+           Read(file, &position[2]) && Read(file, &diameter) &&
+           Read(file, &state) && Read(file, &has_navigation) &&
+           Read(file, &navigation_phase) && Read(file, &path_cursor) &&
+           ReadVector(file, file_size, &path) &&
+           ReadVector(file, file_size, &destinations_list) &&
+           path_cursor <= path.size() / 2;
+      if (!ok) {
+        break;
+      }
+
+      Human* human = new Human(position);
+      human->SetDiameter(diameter);
+      human->state_ = state;
+      human->navigation_phase_ = navigation_phase;
+      human->path_cursor_ = path_cursor;
+      for (size_t i = 0; i + 1 < path.size(); i += 2) {
+        human->path_.push_back({path[i], path[i + 1]});
+      }
+      for (size_t i = 0; i + 1 < destinations_list.size(); i += 2) {
+        human->destinations_list_.push_back(
+          std::make_pair(destinations_list[i], destinations_list[i + 1]));
+      }
+      if (has_navigation) {
+        human->AddBiologyModule(new Navigation());
+      }
+      new_humans.push_back(human);
+    }
+    std::fclose(file);
+
+    if (!ok) {
+      std::cout << "checkpoint " << file_name << " is truncated or corrupted"
+                << std::endl;
+      for (auto* human : new_humans) {
+        delete human;
+      }
+      return false;
+    }
+
+    for (size_t i = 0; i < tile_ids.size(); i++) {
+      navigation_map->SetTileRows(tile_ids[i],
+                                  &tile_rows[i * NavigationMap::kTileSize]);
+    }
+    *landmarks = std::move(new_landmarks);
+    destinations->SetState(destination_list,
+                           std::vector<bool>(taken.begin(), taken.end()));
+    humans->insert(humans->end(), new_humans.begin(), new_humans.end());
+    *simulated_steps = header.simulated_steps;
+    std::cout << "checkpoint loaded (" << new_humans.size() << " humans, "
+              << tile_ids.size() << " map tiles)" << std::endl;
+    return true;
+  } // end LoadCheckpoint
+
+} // namespace bdm
+
+#endif // NAVIGATION_CHECKPOINT_H_
@@ -0,0 +1,179 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef NAVIGATION_MAP_H_
+#define NAVIGATION_MAP_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace bdm {
+
+  // Walkability map used for path planning, split in 64*64 tiles.
+  // A tile is rasterized the first time one of its nodes is queried, so
+  // only the region actually visited by the agents is ever computed and
+  // kept in memory. Tiles are bit packed: one uint64_t per tile row.
+  // IsWalkable() can be called concurrently from any thread.
+  class NavigationMap {
+   public:
+    // return true if node (x, y) of the map is walkable
+    using Rasterizer = std::function<bool(int, int)>;
+
+    static const int kTileSize = 64;
+
+    NavigationMap() {}
+
+    // memory_budget: maximum memory used by the tiles, in bytes (0: no limit)
+    NavigationMap(int map_size, Rasterizer rasterizer, size_t memory_budget = 0)
+        : map_size_(map_size), rasterizer_(rasterizer) {
+      tiles_per_side_ = (map_size + kTileSize - 1) / kTileSize;
+      tiles_.resize(tiles_per_side_ * tiles_per_side_);
+      for (auto& tile : tiles_) {
+        tile.reset(new Tile());
+      }
+      max_tiles_ = memory_budget / (kTileSize * sizeof(uint64_t));
+    }
+
+    NavigationMap(NavigationMap&& other)
+        : map_size_(other.map_size_),
+          tiles_per_side_(other.tiles_per_side_),
+          rasterizer_(std::move(other.rasterizer_)),
+          tiles_(std::move(other.tiles_)),
+          max_tiles_(other.max_tiles_),
+          num_ready_(other.num_ready_.load()),
+          epoch_(other.epoch_) {}
+
+    NavigationMap(const NavigationMap&) = delete;
+    NavigationMap& operator=(const NavigationMap&) = delete;
+
+    int GetSize() const { return map_size_; }
+
+    bool IsWalkable(int x, int y) const {
+      Tile& tile = *tiles_[(x / kTileSize) * tiles_per_side_ + y / kTileSize];
+      if (!tile.ready.load(std::memory_order_acquire)) {
+        Rasterize(x / kTileSize, y / kTileSize);
+      }
+      // only write the access date if it changed, not to bounce cache lines
+      if (tile.last_access.load(std::memory_order_relaxed) != epoch_) {
+        tile.last_access.store(epoch_, std::memory_order_relaxed);
+      }
+      return (tile.rows[x % kTileSize] >> (y % kTileSize)) & 1;
+    }
+
+    // rasterize every tile now, in parallel
+    void RasterizeAll() {
+      const int num_tiles = tiles_.size();
+      #pragma omp parallel for schedule(dynamic)
+      for (int t = 0; t < num_tiles; t++) {
+        if (!tiles_[t]->ready.load(std::memory_order_acquire)) {
+          Rasterize(t / tiles_per_side_, t % tiles_per_side_);
+        }
+      }
+    }
+
+    // drop the least recently used tiles until the memory budget is met.
+    // Must not run concurrently with IsWalkable(), ie between simulation
+    // steps. Return the number of evicted tiles
+    size_t EvictColdTiles() {
+      epoch_++;
+      if (max_tiles_ == 0 || num_ready_ <= max_tiles_) {
+        return 0;
+      }
+      std::vector<std::pair<uint64_t, size_t>> ready;
+      for (size_t t = 0; t < tiles_.size(); t++) {
+        if (tiles_[t]->ready.load(std::memory_order_relaxed)) {
+          ready.emplace_back(tiles_[t]->last_access.load(std::memory_order_relaxed), t);
+        }
+      }
+      size_t to_evict = ready.size() - max_tiles_;
+      std::partial_sort(ready.begin(), ready.begin() + to_evict, ready.end());
+      for (size_t e = 0; e < to_evict; e++) {
+        Tile& tile = *tiles_[ready[e].second];
+        tile.ready.store(false, std::memory_order_relaxed);
+        tile.rows.reset();
+      }
+      num_ready_ -= to_evict;
+      return to_evict;
+    }
+
+    size_t GetNumTiles() const { return tiles_.size(); }
+
+    size_t GetNumRasterizedTiles() const { return num_ready_; }
+
+    bool IsFullyRasterized() const { return num_ready_ == tiles_.size(); }
+
+    // raw tile access, for checkpoints. Tiles are numbered row major and
+    // hold kTileSize rows of kTileSize bits
+    bool IsTileRasterized(size_t t) const {
+      return tiles_[t]->ready.load(std::memory_order_acquire);
+    }
+
+    const uint64_t* GetTileRows(size_t t) const { return tiles_[t]->rows.get(); }
+
+    void SetTileRows(size_t t, const uint64_t* rows) {
+      Tile& tile = *tiles_[t];
+      std::lock_guard<std::mutex> lock(tile.mutex);
+      if (!tile.ready.load(std::memory_order_relaxed)) {
+        num_ready_++;
+      }
+      tile.rows.reset(new uint64_t[kTileSize]);
+      std::copy(rows, rows + kTileSize, tile.rows.get());
+      tile.last_access.store(epoch_, std::memory_order_relaxed);
+      tile.ready.store(true, std::memory_order_release);
+    }
+
+   private:
+    struct Tile {
+      std::atomic<bool> ready{false};
+      std::atomic<uint64_t> last_access{0};
+      std::mutex mutex;
+      // one bit per node, allocated when the tile is rasterized
+      std::unique_ptr<uint64_t[]> rows;
+    };
+
+    int map_size_ = 0;
+    int tiles_per_side_ = 0;
+    Rasterizer rasterizer_;
+    std::vector<std::unique_ptr<Tile>> tiles_;
+    size_t max_tiles_ = 0;
+    mutable std::atomic<size_t> num_ready_{0};
+    // incremented between steps only
+    uint64_t epoch_ = 0;
+
+    // double checked once-initialisation of a tile
+    void Rasterize(int tile_x, int tile_y) const {
+      Tile& tile = *tiles_[tile_x * tiles_per_side_ + tile_y];
+      std::lock_guard<std::mutex> lock(tile.mutex);
+      if (tile.ready.load(std::memory_order_relaxed)) {
+        return;
+      }
+      tile.rows.reset(new uint64_t[kTileSize]);
+      for (int i = 0; i < kTileSize; i++) {
+        uint64_t row = 0;
+        int x = tile_x * kTileSize + i;
+        for (int j = 0; j < kTileSize; j++) {
+          int y = tile_y * kTileSize + j;
+          if (x < map_size_ && y < map_size_ && rasterizer_(x, y)) {
+            row |= uint64_t{1} << j;
+          }
+        }
+        tile.rows[i] = row;
+      }
+      tile.last_access.store(epoch_, std::memory_order_relaxed);
+      num_ready_++;
+      tile.ready.store(true, std::memory_order_release);
+    }
+  }; // end NavigationMap
+
+} // namespace bdm
+
+#endif // NAVIGATION_MAP_H_
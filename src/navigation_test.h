@@ -22,9 +22,45 @@
 #include "util_methods.h"
 #include "navigation_util.h"
 #include "a_star.h"
+#include "landmarks.h"
+#include "destination_manager.h"
+#include "trajectory_writer.h"
+#include "navigation_map.h"
+#include "density_field.h"
+#include "navigation_checkpoint.h"
+#include "anytime_planner.h"
 
 namespace bdm {
 
+// record position and state of every human for this step
+inline void RecordTrajectories(ResourceManager* rm, TrajectoryWriter* writer,
+                               uint64_t step) {
+  writer->BeginStep(step);
+  rm->ApplyOnAllElements([&](SimObject* so) {
+    if (auto* human = dynamic_cast<Human*>(so)) {
+      const auto& position = human->GetPosition();
+      double pos[3] = {position[0], position[1], position[2]};
+      writer->AddRecord(human->GetUid(), pos, human->state_);
+    }
+  });
+  writer->EndStep();
+}
+
+// ---------------------------------------------------------------------------
+// rebuild the agents density field from the humans positions
+inline void UpdateDensityField(ResourceManager* rm, DensityField* density) {
+  std::vector<std::pair<double, double>> positions;
+  rm->ApplyOnAllElements([&](SimObject* so) {
+    if (auto* human = dynamic_cast<Human*>(so)) {
+      const auto& position = human->GetPosition();
+      positions.push_back(std::make_pair(GetBDMToMapLoc(position[0]),
+                                         GetBDMToMapLoc(position[1])));
+    }
+  });
+  density->Update(positions);
+}
+
+// ---------------------------------------------------------------------------
 inline int Simulate(int argc, const char** argv) {
   bdm::Param::RegisterModuleParam(new bdm::SimParam());
 
@@ -35,29 +71,140 @@ inline int Simulate(int argc, const char** argv) {
   auto* rm = simulation.GetResourceManager();
   simulation.GetRandom()->SetSeed(2975); // rand() % 10000
 
-  //construct geom
-  BuildMaze();
-  // construct the 2d array for navigation
-  std::vector<std::vector<bool>> navigation_map = GetNavigationMap();
-
-  // human creation
-  Human* human = new Human({-124, -74, 0});
-  human->SetDiameter(sparam->human_diameter);
-  // get destinations for this human
-  std::vector<std::pair<double, double>> destinations_list = GetFirstDestination();
-  human->destinations_list_= destinations_list;
-  human->AddBiologyModule(new Navigation(&navigation_map));
-  rm->push_back(human);
-
-  // human at test destination
-  human = new Human({124, 74, 0});
-  human->SetDiameter(sparam->human_diameter);
-  rm->push_back(human);
+  // navigation map, its tiles are rasterized on first use
+  NavigationMap navigation_map = GetNavigationMap();
+  // landmarks distance tables for the A* heuristic
+  Landmarks landmarks;
+
+  // agents density, used as a congestion cost by the planner
+  DensityField density;
+  if (sparam->density_weight > 0) {
+    // bins of about one agent footprint
+    density = DensityField(GetMapSize(), GetAgentFootprint(),
+                           sparam->density_weight);
+  }
+
+  // destinations available in the environment, bucketed by agent
+  // footprint: destinations can not be closer than one agent to each other
+  DestinationManager destinations(GetMapSize(), GetAgentFootprint());
+
+  // trajectories recording, written in the background
+  std::unique_ptr<TrajectoryWriter> trajectory_writer;
+  if (!sparam->trajectory_file.empty()) {
+    trajectory_writer.reset(new TrajectoryWriter(sparam->trajectory_file,
+      sparam->trajectory_resolution, sparam->trajectory_keyframe_interval));
+    // nothing to record into
+    if (!trajectory_writer->IsOpen()) {
+      trajectory_writer.reset();
+    }
+  }
+
+  // shared by all the Navigation modules
+  NavigationContext navigation_context;
+  navigation_context.navigation_map = &navigation_map;
+  navigation_context.landmarks = &landmarks;
+  navigation_context.trajectory_writer = trajectory_writer.get();
+  navigation_context.density = &density;
+  // paths searched over several steps
+  AnytimePlannerPool planners;
+  if (sparam->planner_expansion_budget > 0 || sparam->planner_time_budget > 0 ||
+      sparam->planner_step_budget > 0) {
+    navigation_context.planners = &planners;
+  }
+  SetNavigationContext(&navigation_context);
+
+  // resume from a checkpoint: map, landmarks, destinations and humans paths
+  bool restored = false;
+  uint64_t restored_steps = 0;
+  std::vector<Human*> restored_humans;
+  if (!sparam->restore_checkpoint_file.empty()) {
+    restored = LoadCheckpoint(sparam->restore_checkpoint_file, &navigation_map,
+                              &landmarks, &destinations,
+                              &restored_humans, &restored_steps);
+  }
+
+  // the geometry is only needed to rasterize map tiles: those missing from
+  // the checkpoint, or evicted to stay within the memory budget
+  if (!restored || !navigation_map.IsFullyRasterized() ||
+      sparam->navigation_map_memory_budget > 0) {
+    //construct geom
+    BuildMaze();
+    if (sparam->native_geometry) {
+      UseNativeGeometry(sparam->native_geometry_cell_size);
+    }
+  }
+  if (!sparam->lazy_navigation_map) {
+    // each thread rasterizes its own tiles, using its own geometry navigator
+    navigation_map.RasterizeAll();
+  }
+
+  if (restored) {
+    for (auto* h : restored_humans) {
+      rm->push_back(h);
+    }
+  } else {
+    if (sparam->landmark_count > 0) {
+      if (sparam->lazy_navigation_map) {
+        std::cout << "landmarks rasterize the whole navigation map" << std::endl;
+      }
+      landmarks = GetLandmarks(navigation_map, sparam->landmark_count);
+    }
+    AddDestinationsToManager(&destinations);
+
+    // human creation
+    std::vector<Human*> navigating_humans;
+    Human* human = new Human({-124, -74, 0});
+    human->SetDiameter(sparam->human_diameter);
+    human->AddBiologyModule(new Navigation());
+    navigating_humans.push_back(human);
+    rm->push_back(human);
+
+    // get destinations for all navigating humans at once
+    std::vector<Double3> positions;
+    for (auto* h : navigating_humans) {
+      positions.push_back(h->GetPosition());
+    }
+    auto destinations_lists = GetFirstDestinations(positions, &destinations);
+    for (size_t i = 0; i < navigating_humans.size(); i++) {
+      navigating_humans[i]->destinations_list_ = destinations_lists[i];
+    }
+
+    // human at test destination
+    human = new Human({124, 74, 0});
+    human->SetDiameter(sparam->human_diameter);
+    rm->push_back(human);
+  }
 
   // Run simulation for number_of_steps timestep
-  for (uint64_t i = 0; i < sparam->number_of_steps; ++i) {
-    simulation.GetScheduler()->Simulate(1000);
+  auto* scheduler = simulation.GetScheduler();
+  for (uint64_t i = restored_steps / 1000; i < sparam->number_of_steps; ++i) {
+    if (trajectory_writer || !density.Empty()) {
+      for (int step = 0; step < 1000; step++) {
+        if (!density.Empty()) {
+          UpdateDensityField(rm, &density);
+        }
+        scheduler->Simulate(1);
+        if (trajectory_writer) {
+          RecordTrajectories(rm, trajectory_writer.get(),
+                             scheduler->GetSimulatedSteps());
+        }
+      }
+    } else {
+      scheduler->Simulate(1000);
+    }
+    // free the navigation map tiles not used recently, if over budget
+    navigation_map.EvictColdTiles();
+
+    if (!sparam->checkpoint_file.empty() && sparam->checkpoint_interval > 0 &&
+        (i + 1) % sparam->checkpoint_interval == 0) {
+      SaveCheckpoint(sparam->checkpoint_file, navigation_map, landmarks,
+                     destinations, rm, (i + 1) * 1000);
+    }
+  }
+  if (trajectory_writer) {
+    trajectory_writer->Close();
   }
+  SetNavigationContext(nullptr);
 
   std::cout << "done" << std::endl;
   return 0;
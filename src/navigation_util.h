@@ -8,8 +8,12 @@
 #ifndef NAVIGATION_UTIL_
 #define NAVIGATION_UTIL_
 
+#include <algorithm>
+#include <cmath>
 #include "geom.h"
 #include "sim-param.h"
+#include "destination_manager.h"
+#include "navigation_map.h"
 
 namespace bdm {
 
@@ -40,66 +44,111 @@ inline double GetMapSize() {
 }
 
 // ---------------------------------------------------------------------------
-  inline std::vector<std::vector<bool>> GetNavigationMap() {
+// width of an agent, in map nodes
+inline int GetAgentFootprint() {
+  auto* sim = Simulation::GetActive();
+  auto* sparam = sim->GetParam()->GetModuleParam<SimParam>();
+
+  return std::max(1, static_cast<int>(std::ceil(sparam->human_diameter /
+                                                sparam->map_pixel_size)));
+}
+
+// ---------------------------------------------------------------------------
+  // check if an agent can stand on node (x, y) of the navigation map
+  inline bool IsNavigationNodeFree(int x, int y) {
     auto* sim = Simulation::GetActive();
     auto* param = sim->GetParam();
     auto* sparam = param->GetModuleParam<SimParam>();
 
-    double map_size = GetMapSize();
-    std::vector<std::vector<bool>> navigation_map(map_size, std::vector<bool>(map_size, true));
-
-    for (int x = 0 ; x < map_size ; x ++) {
-      for (int y = 0; y < map_size ; y ++) {
-        double pos_x = GetMapToBDMLoc(x);
-        double pos_y = GetMapToBDMLoc(y);
-        Double3 position = {pos_x, pos_y, 0.0};
-        if (IsInsideStructure(position) ||
-            // x axis
-            ObjectInbetween({pos_x - sparam->human_diameter/2, pos_y, 0.0},
-                            {pos_x + sparam->human_diameter/2, pos_y, 0.0}) ||
-            // y axis
-            ObjectInbetween({pos_x, pos_y - sparam->human_diameter/2, 0.0},
-                            {pos_x, pos_y + sparam->human_diameter/2, 0.0}) ||
-            // diagonals
-            ObjectInbetween({pos_x - sparam->human_diameter/2 * 0.7,
-                             pos_y - sparam->human_diameter/2 * 0.7, 0.0},
-                            {pos_x + sparam->human_diameter/2 * 0.7,
-                             pos_y + sparam->human_diameter/2 * 0.7, 0.0}) ||
-           ObjectInbetween({pos_x - sparam->human_diameter/2 * 0.7,
-                            pos_y + sparam->human_diameter/2 * 0.7, 0.0},
-                           {pos_x + sparam->human_diameter/2 * 0.7,
-                            pos_y - sparam->human_diameter/2 * 0.7, 0.0}) ||
-            // z axis
-            ObjectInbetween({pos_x, pos_y,-sparam->human_diameter/2},
-                            {pos_x, pos_y, sparam->human_diameter/2}) ) {
-          navigation_map[x][y] = false;
-        }
-      }
+    double pos_x = GetMapToBDMLoc(x);
+    double pos_y = GetMapToBDMLoc(y);
+    Double3 position = {pos_x, pos_y, 0.0};
+    if (IsInsideStructure(position) ||
+        // x axis
+        ObjectInbetween({pos_x - sparam->human_diameter/2, pos_y, 0.0},
+                        {pos_x + sparam->human_diameter/2, pos_y, 0.0}) ||
+        // y axis
+        ObjectInbetween({pos_x, pos_y - sparam->human_diameter/2, 0.0},
+                        {pos_x, pos_y + sparam->human_diameter/2, 0.0}) ||
+        // diagonals
+        ObjectInbetween({pos_x - sparam->human_diameter/2 * 0.7,
+                         pos_y - sparam->human_diameter/2 * 0.7, 0.0},
+                        {pos_x + sparam->human_diameter/2 * 0.7,
+                         pos_y + sparam->human_diameter/2 * 0.7, 0.0}) ||
+       ObjectInbetween({pos_x - sparam->human_diameter/2 * 0.7,
+                        pos_y + sparam->human_diameter/2 * 0.7, 0.0},
+                       {pos_x + sparam->human_diameter/2 * 0.7,
+                        pos_y - sparam->human_diameter/2 * 0.7, 0.0}) ||
+        // z axis
+        ObjectInbetween({pos_x, pos_y,-sparam->human_diameter/2},
+                        {pos_x, pos_y, sparam->human_diameter/2}) ) {
+      return false;
     }
+    return true;
+  } // end IsNavigationNodeFree
+
+// ---------------------------------------------------------------------------
+  // the map tiles are rasterized on first use by the planner, or with
+  // NavigationMap::RasterizeAll() once the geometry is built
+  inline NavigationMap GetNavigationMap() {
+    auto* sim = Simulation::GetActive();
+    auto* param = sim->GetParam();
+    auto* sparam = param->GetModuleParam<SimParam>();
+
+    NavigationMap navigation_map(GetMapSize(), IsNavigationNodeFree,
+      static_cast<size_t>(sparam->navigation_map_memory_budget * 1024 * 1024));
+
     std::cout << "navigation map created" << std::endl;
     return navigation_map;
   } // end GetNavigationMap
 
 // ---------------------------------------------------------------------------
-inline std::vector<std::pair<double, double>> AddDestinationToList(std::vector<std::pair<double, double>> destinations_list) {
-  //TODO: create destination point depending on the environment:
-  //      going to a seat? is destination a wall? etc.
-  //      destination also depending on human previously created (same seat?)
-  // list of list to check if destination is already taken?
+// register the destinations of the environment into the manager
+inline void AddDestinationsToManager(DestinationManager* destinations) {
+  //TODO: create destination points depending on the environment:
+  //      seats, exits, etc.
 
   //TODO: remove hard coded destination
-  destinations_list.push_back(std::make_pair(GetBDMToMapLoc(124), GetBDMToMapLoc(74)));
+  destinations->AddDestination(std::make_pair(GetBDMToMapLoc(124), GetBDMToMapLoc(74)));
+} // end AddDestinationsToManager
+
+// ---------------------------------------------------------------------------
+inline std::vector<std::pair<double, double>> AddDestinationToList(
+    std::vector<std::pair<double, double>> destinations_list,
+    DestinationManager* destinations, int destination_id) {
+  if (destination_id != DestinationManager::kNone) {
+    destinations_list.push_back(destinations->GetDestination(destination_id));
+  }
 
   return destinations_list;
 } // end AddDestinationToList
 
 // ---------------------------------------------------------------------------
-inline std::vector<std::pair<double, double>> GetFirstDestination() {
-  std::vector<std::pair<double, double>> destinations_list;
-  destinations_list = AddDestinationToList(destinations_list);
+// get the first destination of a batch of agents, from their bdm positions.
+// destinations are allocated all at once, one agent per destination; agents
+// get an empty list if no destination is left
+inline std::vector<std::vector<std::pair<double, double>>> GetFirstDestinations(
+    const std::vector<Double3>& positions, DestinationManager* destinations) {
+  auto* sim = Simulation::GetActive();
+  auto* param = sim->GetParam();
+  auto* sparam = param->GetModuleParam<SimParam>();
 
-  return destinations_list;
-} // end GetDestinationsList
+  std::vector<std::pair<double, double>> map_positions;
+  for (auto& position : positions) {
+    map_positions.push_back(std::make_pair(GetBDMToMapLoc(position[0]),
+                                           GetBDMToMapLoc(position[1])));
+  }
+  std::vector<int> assignment = destinations->Assign(map_positions,
+    DestinationManager::GetMode(sparam->destination_assignment));
+
+  std::vector<std::vector<std::pair<double, double>>> destinations_lists(positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    destinations_lists[i] = AddDestinationToList(destinations_lists[i],
+                                                 destinations, assignment[i]);
+  }
+
+  return destinations_lists;
+} // end GetFirstDestinations
 
 } // namespace bdm
 
@@ -23,6 +23,25 @@ void SimParam::AssignFromConfig(const std::shared_ptr<cpptoml::table>& config) {
   BDM_ASSIGN_PARAM_VALUE(number_of_steps);
   BDM_ASSIGN_PARAM_VALUE(human_diameter);
   BDM_ASSIGN_PARAM_VALUE(map_pixel_size);
+  BDM_ASSIGN_PARAM_VALUE(lazy_navigation_map);
+  BDM_ASSIGN_PARAM_VALUE(navigation_map_memory_budget);
+  BDM_ASSIGN_PARAM_VALUE(landmark_count);
+  BDM_ASSIGN_PARAM_VALUE(density_weight);
+  BDM_ASSIGN_PARAM_VALUE(density_replan_interval);
+  BDM_ASSIGN_PARAM_VALUE(planner_expansion_budget);
+  BDM_ASSIGN_PARAM_VALUE(planner_time_budget);
+  BDM_ASSIGN_PARAM_VALUE(planner_step_budget);
+  BDM_ASSIGN_PARAM_VALUE(planner_epsilon);
+  BDM_ASSIGN_PARAM_VALUE(planner_epsilon_step);
+  BDM_ASSIGN_PARAM_VALUE(destination_assignment);
+  BDM_ASSIGN_PARAM_VALUE(trajectory_file);
+  BDM_ASSIGN_PARAM_VALUE(trajectory_resolution);
+  BDM_ASSIGN_PARAM_VALUE(trajectory_keyframe_interval);
+  BDM_ASSIGN_PARAM_VALUE(checkpoint_file);
+  BDM_ASSIGN_PARAM_VALUE(checkpoint_interval);
+  BDM_ASSIGN_PARAM_VALUE(restore_checkpoint_file);
+  BDM_ASSIGN_PARAM_VALUE(native_geometry);
+  BDM_ASSIGN_PARAM_VALUE(native_geometry_cell_size);
 }
 
 }  // namespace bdm
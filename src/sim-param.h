@@ -8,6 +8,7 @@
 #ifndef SIM_PARAM_H_
 #define SIM_PARAM_H_
 
+#include <string>
 #include "core/param/module_param.h"
 
 namespace bdm {
@@ -25,13 +26,50 @@ struct SimParam : public ModuleParam {
   uint64_t number_of_steps = 30;
   double human_diameter = 50; // cm
   int map_pixel_size = 1;
+  // rasterize the navigation map tiles on first use
+  bool lazy_navigation_map = true;
+  // memory limit of the navigation map tiles, in MB (0 for no limit)
+  double navigation_map_memory_budget = 0;
+  // number of ALT landmarks used by A* (0 to disable). Each landmark keeps
+  // a full map distance table, and building them rasterizes the whole map:
+  // with a lazy navigation map, keep 0
+  int landmark_count = 0;
+  // congestion cost of a node, per agent in its density bin (0 to disable)
+  double density_weight = 0;
+  // agents replan their path every density_replan_interval steps (0: never)
+  uint64_t density_replan_interval = 50;
+  // resumable path search: node expansions per agent per step, time per
+  // agent per step (us) and node expansions per step for all the agents.
+  // All 0: each path is computed at once
+  uint64_t planner_expansion_budget = 0;
+  double planner_time_budget = 0;
+  uint64_t planner_step_budget = 0;
+  // resumable search first path is at most planner_epsilon times longer
+  // than the shortest one, then improved by planner_epsilon_step (ARA*)
+  double planner_epsilon = 1;
+  double planner_epsilon_step = 0.5;
+  // destination allocation: "greedy" or "auction"
+  std::string destination_assignment = "greedy";
+  // binary trajectory output (empty to disable)
+  std::string trajectory_file = "";
+  double trajectory_resolution = 0.1; // cm
+  uint32_t trajectory_keyframe_interval = 100;
+  // navigation state snapshot, every checkpoint_interval * 1000 steps
+  // (empty to disable)
+  std::string checkpoint_file = "";
+  uint64_t checkpoint_interval = 1;
+  // resume from this navigation state snapshot (empty to start from scratch)
+  std::string restore_checkpoint_file = "";
+  // answer geometry queries with the native box backend instead of TGeo
+  bool native_geometry = false;
+  double native_geometry_cell_size = 10; // cm
 
  protected:
   /// Assign values from config file to variables
   void AssignFromConfig(const std::shared_ptr<cpptoml::table>&) override;
 
  private:
-  BDM_CLASS_DEF_OVERRIDE(SimParam, 1);
+  BDM_CLASS_DEF_OVERRIDE(SimParam, 2);
 };
 
 }  // namespace bdm
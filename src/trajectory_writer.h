@@ -0,0 +1,528 @@
+// -----------------------------------------------------------------------------
+//
+// Copyright (C) Jean de Montigny.
+// All Rights Reserved.
+//
+// -----------------------------------------------------------------------------
+
+#ifndef TRAJECTORY_WRITER_H_
+#define TRAJECTORY_WRITER_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bdm {
+
+  // Trajectory file layout (little endian):
+  //   file header  | chunk 0 | chunk 1 | ... | chunk index | trailer
+  // One chunk per recorded step. Positions are quantized to `resolution`
+  // and stored as the difference with the agent position in the previous
+  // chunk, except in key frames (every `keyframe_interval` chunks) where they
+  // are absolute, so that a reader only has to decode from the last key frame.
+  // Integers are LEB128 varints, signed ones zigzag encoded.
+  // The chunk index and trailer are written on Close(); a file without them
+  // (interrupted run) can still be read by scanning the chunks.
+
+  struct TrajectoryFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keyframe_interval;
+    double resolution;
+  };
+
+  struct TrajectoryChunkHeader {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t step;
+    uint32_t num_records;
+    uint32_t num_events;
+    uint64_t payload_size;
+  };
+
+  struct TrajectoryTrailer {
+    uint64_t index_offset;
+    uint64_t num_chunks;
+    char magic[8];
+  };
+
+  // position and state of one agent at one step
+  struct TrajectoryRecord {
+    uint64_t uid;
+    double position[3];
+    int32_t state;
+  };
+
+  // path planning events of the Navigation behavior
+  struct PathEvent {
+    enum Type : uint8_t { kPathComputed = 0, kPathNotFound = 1, kDestinationReached = 2 };
+    uint64_t uid;
+    uint8_t type;
+    // number of nodes of the computed path
+    uint64_t value;
+  };
+
+  namespace trajectory {
+    static const char kFileMagic[8] = {'N', 'A', 'V', 'T', 'R', 'A', 'J', '\0'};
+    static const char kTrailerMagic[8] = {'N', 'A', 'V', 'T', 'E', 'N', 'D', '\0'};
+    static const uint32_t kChunkMagic = 0x4b4e4843;  // "CHNK"
+    static const uint32_t kVersion = 1;
+    static const uint32_t kKeyFrame = 1;
+
+    inline void PutVarint(uint64_t value, std::vector<uint8_t>* out) {
+      while (value >= 0x80) {
+        out->push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+      }
+      out->push_back(static_cast<uint8_t>(value));
+    }
+
+    inline uint64_t GetVarint(const uint8_t** in) {
+      uint64_t value = 0;
+      int shift = 0;
+      while (**in & 0x80) {
+        value |= static_cast<uint64_t>(**in & 0x7f) << shift;
+        shift += 7;
+        (*in)++;
+      }
+      value |= static_cast<uint64_t>(**in) << shift;
+      (*in)++;
+      return value;
+    }
+
+    inline uint64_t ZigZag(int64_t value) {
+      return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    inline int64_t UnZigZag(uint64_t value) {
+      return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+  } // namespace trajectory
+
+// ---------------------------------------------------------------------------
+  // Append agents trajectories to a binary file. Steps are buffered by the
+  // simulation thread(s), then encoded and written by a background thread.
+  // AddRecord() must be called between BeginStep() and EndStep() by a single
+  // thread; AddEvent() can be called from any thread at any time.
+  class TrajectoryWriter {
+   public:
+    TrajectoryWriter(const std::string& file_name, double resolution,
+                     uint32_t keyframe_interval, size_t max_pending_steps = 4)
+        : resolution_(resolution),
+          keyframe_interval_(std::max<uint32_t>(1, keyframe_interval)),
+          max_pending_steps_(std::max<size_t>(1, max_pending_steps)) {
+      file_ = std::fopen(file_name.c_str(), "wb");
+      if (!file_) {
+        std::cout << "could not open trajectory file " << file_name << std::endl;
+        return;
+      }
+      // large stdio buffer, chunks are written in one go anyway
+      std::setvbuf(file_, nullptr, _IOFBF, 1 << 22);
+
+      TrajectoryFileHeader header;
+      std::memcpy(header.magic, trajectory::kFileMagic, sizeof(header.magic));
+      header.version = trajectory::kVersion;
+      header.keyframe_interval = keyframe_interval_;
+      header.resolution = resolution_;
+      Write(&header, sizeof(header));
+
+      writer_thread_ = std::thread(&TrajectoryWriter::WriterLoop, this);
+    }
+
+    ~TrajectoryWriter() { Close(); }
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    bool IsOpen() const { return file_ != nullptr; }
+
+    // true if a write failed (disk full...): the file is incomplete
+    bool HasFailed() const { return failed_; }
+
+    void BeginStep(uint64_t step) {
+      current_.step = step;
+      current_.records.clear();
+    }
+
+    void AddRecord(uint64_t uid, const double* position, int state) {
+      TrajectoryRecord record;
+      record.uid = uid;
+      record.position[0] = position[0];
+      record.position[1] = position[1];
+      record.position[2] = position[2];
+      record.state = state;
+      current_.records.push_back(record);
+    }
+
+    void AddEvent(uint64_t uid, PathEvent::Type type, uint64_t value = 0) {
+      std::lock_guard<std::mutex> lock(events_mutex_);
+      events_.push_back({uid, type, value});
+    }
+
+    // hand the step over to the writer thread. Blocks if the writer thread
+    // is more than max_pending_steps behind, to bound memory usage
+    void EndStep() {
+      if (!IsOpen()) {
+        std::lock_guard<std::mutex> lock(events_mutex_);
+        events_.clear();
+        current_.records.clear();
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(events_mutex_);
+        current_.events.swap(events_);
+        events_.clear();
+      }
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_not_full_.wait(lock, [this] { return queue_.size() < max_pending_steps_; });
+      queue_.push_back(std::move(current_));
+      current_ = Step();
+      // reuse the buffers of an already written step
+      if (!free_steps_.empty()) {
+        current_ = std::move(free_steps_.back());
+        free_steps_.pop_back();
+      }
+      queue_not_empty_.notify_one();
+    }
+
+    // write the remaining steps, the chunk index and close the file
+    void Close() {
+      if (!IsOpen()) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        closing_ = true;
+        queue_not_empty_.notify_one();
+      }
+      writer_thread_.join();
+
+      TrajectoryTrailer trailer;
+      trailer.index_offset = offset_;
+      trailer.num_chunks = chunk_offsets_.size();
+      std::memcpy(trailer.magic, trajectory::kTrailerMagic, sizeof(trailer.magic));
+      Write(chunk_offsets_.data(), chunk_offsets_.size() * sizeof(uint64_t));
+      Write(&trailer, sizeof(trailer));
+      if (std::fclose(file_) != 0) {
+        failed_ = true;
+      }
+      file_ = nullptr;
+      if (failed_) {
+        std::cout << "trajectory file could not be written completely" << std::endl;
+      }
+    }
+
+   private:
+    struct Step {
+      uint64_t step = 0;
+      std::vector<TrajectoryRecord> records;
+      std::vector<PathEvent> events;
+    };
+
+    double resolution_;
+    uint32_t keyframe_interval_;
+    size_t max_pending_steps_;
+    std::FILE* file_ = nullptr;
+    uint64_t offset_ = 0;
+    // set by the writer thread, nothing is written after a failure
+    std::atomic<bool> failed_{false};
+
+    // filled by the simulation
+    Step current_;
+    std::vector<PathEvent> events_;
+    std::mutex events_mutex_;
+
+    // steps waiting to be written
+    std::deque<Step> queue_;
+    std::vector<Step> free_steps_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_not_empty_;
+    std::condition_variable queue_not_full_;
+    bool closing_ = false;
+    std::thread writer_thread_;
+
+    // only accessed by the writer thread (and by Close() once joined)
+    std::vector<uint64_t> chunk_offsets_;
+    std::unordered_map<uint64_t, std::array<int64_t, 3>> last_positions_;
+    std::vector<uint8_t> payload_;
+
+    void Write(const void* data, size_t size) {
+      if (failed_) {
+        return;
+      }
+      if (std::fwrite(data, 1, size, file_) != size) {
+        failed_ = true;
+        return;
+      }
+      offset_ += size;
+    }
+
+    void WriterLoop() {
+      while (true) {
+        Step step;
+        {
+          std::unique_lock<std::mutex> lock(queue_mutex_);
+          queue_not_empty_.wait(lock, [this] { return !queue_.empty() || closing_; });
+          if (queue_.empty()) {
+            return;
+          }
+          step = std::move(queue_.front());
+          queue_.pop_front();
+          queue_not_full_.notify_one();
+        }
+        WriteChunk(&step);
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        step.records.clear();
+        step.events.clear();
+        free_steps_.push_back(std::move(step));
+      }
+    }
+
+    void WriteChunk(Step* step) {
+      const bool keyframe = chunk_offsets_.size() % keyframe_interval_ == 0;
+      if (keyframe) {
+        last_positions_.clear();
+      }
+      std::sort(step->records.begin(), step->records.end(),
+                [](const TrajectoryRecord& a, const TrajectoryRecord& b) {
+                  return a.uid < b.uid;
+                });
+
+      payload_.clear();
+      uint64_t previous_uid = 0;
+      for (auto& record : step->records) {
+        std::array<int64_t, 3> quantized;
+        for (int i = 0; i < 3; i++) {
+          quantized[i] = std::llround(record.position[i] / resolution_);
+        }
+        // uids are sorted: store the gap with the previous one
+        trajectory::PutVarint(record.uid - previous_uid, &payload_);
+        previous_uid = record.uid;
+
+        // state and a "position is absolute" bit, for agents absent
+        // from the previous chunk
+        auto last = last_positions_.find(record.uid);
+        bool absolute = last == last_positions_.end();
+        trajectory::PutVarint(
+            (trajectory::ZigZag(record.state) << 1) | (absolute ? 1 : 0), &payload_);
+        for (int i = 0; i < 3; i++) {
+          int64_t delta = absolute ? quantized[i] : quantized[i] - last->second[i];
+          trajectory::PutVarint(trajectory::ZigZag(delta), &payload_);
+        }
+        if (absolute) {
+          last_positions_.emplace(record.uid, quantized);
+        } else {
+          last->second = quantized;
+        }
+      }
+      for (auto& event : step->events) {
+        trajectory::PutVarint(event.uid, &payload_);
+        payload_.push_back(event.type);
+        trajectory::PutVarint(event.value, &payload_);
+      }
+
+      TrajectoryChunkHeader header;
+      header.magic = trajectory::kChunkMagic;
+      header.flags = keyframe ? trajectory::kKeyFrame : 0;
+      header.step = step->step;
+      header.num_records = step->records.size();
+      header.num_events = step->events.size();
+      header.payload_size = payload_.size();
+      chunk_offsets_.push_back(offset_);
+      Write(&header, sizeof(header));
+      Write(payload_.data(), payload_.size());
+    } // end WriteChunk
+  }; // end TrajectoryWriter
+
+// ---------------------------------------------------------------------------
+  // Memory mapped access to a trajectory file
+  class TrajectoryReader {
+   public:
+    explicit TrajectoryReader(const std::string& file_name) {
+      int fd = open(file_name.c_str(), O_RDONLY);
+      if (fd < 0) {
+        std::cout << "could not open trajectory file " << file_name << std::endl;
+        return;
+      }
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(TrajectoryFileHeader))) {
+        size_ = st.st_size;
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          data_ = static_cast<const uint8_t*>(data);
+        }
+      }
+      close(fd);
+      if (!data_ || std::memcmp(GetHeader().magic, trajectory::kFileMagic, 8) != 0) {
+        std::cout << "invalid trajectory file " << file_name << std::endl;
+        Unmap();
+        return;
+      }
+      LoadIndex();
+    }
+
+    ~TrajectoryReader() { Unmap(); }
+
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    bool IsOpen() const { return data_ != nullptr; }
+
+    const TrajectoryFileHeader& GetHeader() const {
+      return *reinterpret_cast<const TrajectoryFileHeader*>(data_);
+    }
+
+    size_t GetNumChunks() const { return chunk_offsets_.size(); }
+
+    uint64_t GetStep(size_t chunk) const { return GetChunkHeader(chunk).step; }
+
+    // decode chunk `chunk`, starting from its key frame
+    void ReadChunk(size_t chunk, std::vector<TrajectoryRecord>* records,
+                   std::vector<PathEvent>* events = nullptr) const {
+      size_t keyframe = chunk;
+      while (keyframe > 0 && !(GetChunkHeader(keyframe).flags & trajectory::kKeyFrame)) {
+        keyframe--;
+      }
+      std::unordered_map<uint64_t, std::array<int64_t, 3>> positions;
+      for (size_t c = keyframe; c <= chunk; c++) {
+        DecodeChunk(c, &positions, c == chunk ? records : nullptr,
+                    c == chunk ? events : nullptr);
+      }
+    }
+
+   private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    std::vector<uint64_t> chunk_offsets_;
+
+    void Unmap() {
+      if (data_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+        data_ = nullptr;
+      }
+    }
+
+    // chunks are not aligned in the file
+    TrajectoryChunkHeader GetChunkHeader(size_t chunk) const {
+      TrajectoryChunkHeader header;
+      std::memcpy(&header, data_ + chunk_offsets_[chunk], sizeof(header));
+      return header;
+    }
+
+    // read the chunk index of the trailer, if it is consistent with the
+    // file: the index and every chunk must lie inside the mapping
+    bool LoadTrailerIndex(const TrajectoryTrailer& trailer) {
+      const uint64_t index_end = size_ - sizeof(trailer);
+      if (trailer.index_offset < sizeof(TrajectoryFileHeader) ||
+          trailer.index_offset > index_end ||
+          trailer.num_chunks > (index_end - trailer.index_offset) / sizeof(uint64_t)) {
+        return false;
+      }
+      std::vector<uint64_t> offsets(trailer.num_chunks);
+      std::memcpy(offsets.data(), data_ + trailer.index_offset,
+                  offsets.size() * sizeof(uint64_t));
+      for (auto offset : offsets) {
+        if (offset < sizeof(TrajectoryFileHeader) ||
+            offset > trailer.index_offset ||
+            trailer.index_offset - offset < sizeof(TrajectoryChunkHeader)) {
+          return false;
+        }
+        TrajectoryChunkHeader header;
+        std::memcpy(&header, data_ + offset, sizeof(header));
+        if (header.magic != trajectory::kChunkMagic ||
+            header.payload_size > trailer.index_offset - offset - sizeof(header)) {
+          return false;
+        }
+      }
+      chunk_offsets_.swap(offsets);
+      return true;
+    }
+
+    void LoadIndex() {
+      // complete file: use the chunk index
+      if (size_ >= sizeof(TrajectoryFileHeader) + sizeof(TrajectoryTrailer)) {
+        TrajectoryTrailer trailer;
+        std::memcpy(&trailer, data_ + size_ - sizeof(trailer), sizeof(trailer));
+        if (std::memcmp(trailer.magic, trajectory::kTrailerMagic, 8) == 0 &&
+            LoadTrailerIndex(trailer)) {
+          return;
+        }
+      }
+      // interrupted run: scan the complete chunks
+      uint64_t offset = sizeof(TrajectoryFileHeader);
+      while (offset + sizeof(TrajectoryChunkHeader) <= size_) {
+        TrajectoryChunkHeader header;
+        std::memcpy(&header, data_ + offset, sizeof(header));
+        if (header.magic != trajectory::kChunkMagic ||
+            offset + sizeof(header) + header.payload_size > size_) {
+          break;
+        }
+        chunk_offsets_.push_back(offset);
+        offset += sizeof(header) + header.payload_size;
+      }
+    }
+
+    void DecodeChunk(size_t chunk,
+                     std::unordered_map<uint64_t, std::array<int64_t, 3>>* positions,
+                     std::vector<TrajectoryRecord>* records,
+                     std::vector<PathEvent>* events) const {
+      const TrajectoryChunkHeader header = GetChunkHeader(chunk);
+      const double resolution = GetHeader().resolution;
+      const uint8_t* in = data_ + chunk_offsets_[chunk] + sizeof(header);
+      if (records) {
+        records->clear();
+        records->reserve(header.num_records);
+      }
+      uint64_t uid = 0;
+      for (uint32_t r = 0; r < header.num_records; r++) {
+        uid += trajectory::GetVarint(&in);
+        uint64_t state_flag = trajectory::GetVarint(&in);
+        bool absolute = state_flag & 1;
+        auto& position = (*positions)[uid];
+        for (int i = 0; i < 3; i++) {
+          int64_t value = trajectory::UnZigZag(trajectory::GetVarint(&in));
+          position[i] = absolute ? value : position[i] + value;
+        }
+        if (records) {
+          TrajectoryRecord record;
+          record.uid = uid;
+          record.state = trajectory::UnZigZag(state_flag >> 1);
+          for (int i = 0; i < 3; i++) {
+            record.position[i] = position[i] * resolution;
+          }
+          records->push_back(record);
+        }
+      }
+      if (events) {
+        events->clear();
+        for (uint32_t e = 0; e < header.num_events; e++) {
+          PathEvent event;
+          event.uid = trajectory::GetVarint(&in);
+          event.type = *in++;
+          event.value = trajectory::GetVarint(&in);
+          events->push_back(event);
+        }
+      }
+    } // end DecodeChunk
+  }; // end TrajectoryReader
+
+} // namespace bdm
+
+#endif // TRAJECTORY_WRITER_H_